@@ -8,14 +8,16 @@
  */
 
 #include "size_bucket.h"
+#include "file_cell.h"
 
 #ifndef AGE_BUCKET_
 #define AGE_BUCKET_
-using namespace boost::unordered;
 class AgeBucket {
   public:
-    File *f; // pointer to start of file as per bucket cutoff
-    unordered_map<size_t, SizeBucket> *sb;
+    uint32_t f; // id of the oldest file in the bucket, 0 if empty
+    FileTable *ft; // table the file ids refer to
+    FileCell *cells; // size x dir cells of this bucket, size major
+    int num_dirs; // number of dir cells per size
     uint64_t count; // count of all files in bucket
     uint64_t cutoff; // cutoff for bucket
     double ideal_fraction; // ideal fraction of total files in this bucket
@@ -23,10 +25,12 @@ class AgeBucket {
     bool youngest_bucket; // flag to indicate youngest bucket
     int id; // bucket id
     double ratio; // the ratio of what % of files
-    File *last; // youngest file in bucket
+    uint32_t last; // id of the youngest file in bucket
 
     AgeBucket() {
-      sb = NULL;
+      ft = NULL;
+      cells = NULL;
+      num_dirs = 0;
       count = 0;
       cutoff = 0;
       actual_fraction = 0;
@@ -34,12 +38,14 @@ class AgeBucket {
       youngest_bucket = false;
       id = 0;
       ratio = 0;
-      f = NULL;
-      last = NULL;
+      f = 0;
+      last = 0;
     }
 
     AgeBucket(int id) {
-      sb = NULL;
+      ft = NULL;
+      cells = NULL;
+      num_dirs = 0;
       count = 0;
       cutoff = 0;
       actual_fraction = 0;
@@ -47,8 +53,8 @@ class AgeBucket {
       youngest_bucket = false;
       this->id = id;
       ratio = 0;
-      f = NULL;
-      last = NULL;
+      f = 0;
+      last = 0;
     }
 
     /*
@@ -75,7 +81,9 @@ class AgeBucket {
       cutoff = b.cutoff;
       actual_fraction = b.actual_fraction;
       ideal_fraction = b.ideal_fraction;
-      sb = b.sb;
+      ft = b.ft;
+      cells = b.cells;
+      num_dirs = b.num_dirs;
       f = b.f;
       youngest_bucket = b.youngest_bucket;
       id = b.id;
@@ -83,27 +91,15 @@ class AgeBucket {
       last = b.last;
     }
 
-    void addFile(File *f, uint64_t live_file_count, bool at_front) {
+    void addFile(uint32_t f, uint64_t live_file_count, bool at_front) {
+      auto &file = (*ft)[f];
       count++;
-      auto s = (sb->find(f->size))->second;
-      sb->erase(f->size);
-
-      auto d = (s.db->find(f->depth))->second;
-      s.db->erase(f->depth);
-      d.addFile(f, live_file_count);
-      s.db->insert(std::pair<int, DirBucket>(f->depth, d));
-
-      s.count++;
-      if(s.count == 1) {
-        assert(s.start == NULL);
-        s.start = f;
-      }
-      sb->insert(std::pair<size_t, SizeBucket>(f->size, s));
+      cell(file.size_id, file.dir_id).addFile(*ft, f);
       actual_fraction = ((double) count / live_file_count);
 
-      if(this->f == NULL) {
+      if(this->f == 0) {
         this->f = f;
-        assert(this->last == NULL);
+        assert(this->last == 0);
         this->last = f;
       }
 
@@ -115,59 +111,43 @@ class AgeBucket {
       }
     }
 
-    void deleteFile(File *f, uint64_t live_file_count) {
+    void deleteFile(uint32_t f, uint64_t live_file_count) {
       /*
        * Steps in deleting file from AgeBucket.
        * 1. adjust count.
        * 2. adjust actual_fraction.
-       * 3. remove file from size bucket.
+       * 3. remove file from its size x dir cell.
        * 4. adjust f if necessary.
        * 5. adjust last if necessary.
        */
       this->count--;
       actual_fraction = ((double) count / live_file_count);
-      auto s = (sb->find(f->size))->second;
-      sb->erase(f->size);
-
-      auto d = (s.db->find(f->depth))->second;
-      s.db->erase(f->depth);
-      d.deleteFile(f, live_file_count);
-      s.db->insert(std::pair<int, DirBucket>(f->depth, d));
-
-      s.count--;
-      if(s.count == 0) {
-        s.start = NULL;
-      } else if(s.start == f) {
-        s.start = f->size_next;
-      }
-      sb->insert(std::pair<size_t, SizeBucket>(f->size, s));
+      auto &file = (*ft)[f];
+      cell(file.size_id, file.dir_id).deleteFile(*ft, f);
       if(count == 0) {
-        this->f = NULL;
-        this->last = NULL;
+        this->f = 0;
+        this->last = 0;
       } else if(this->f == f) {
-        this->f = f->next;
+        this->f = file.next;
       }
 
       if((this->last == f) && (count > 0)) {
-        this->last = f->prev;
+        this->last = file.prev;
       }
     }
 
-    std::string replace(unordered_map<int, std::string>& age_bucket_keys) {
-      auto key = age_bucket_keys[this->id];
-      auto new_key = this->getKey();
-      age_bucket_keys[this->id] = new_key;
-      return key;
+    BucketKey getKey() {
+      auto difference = this->actual_fraction - this->ideal_fraction;
+      return BucketKey(this->id, difference);
     }
 
-    std::string getKey() {
-      auto difference = this->actual_fraction - this->ideal_fraction;
-      return (std::to_string(this->id) + " " + std::to_string(difference));
+    FileCell& cell(int size_id, int dir_id) {
+      return cells[size_id * num_dirs + dir_id];
     }
 
-    File * getFileToDelete(size_t size, int dir) {
-      auto s = (sb->find(size))->second;
-      return s.getFileToDelete(dir);
+    uint32_t getFileToDelete(int size_id, int dir_id,
+        boost::random::mt19937 &gen) {
+      return cell(size_id, dir_id).getFileToDelete(gen);
     }
 };
 #endif
@@ -7,41 +7,48 @@
  * found in the LICENSE file. See the AUTHORS file for names of contributors.
  */
 
-#include "file.h"
+#include "file_table.h"
 
 #ifndef AGE_LIST_
 #define AGE_LIST_
+/*
+ * AgeList chains every live file from oldest to youngest.  It is a
+ * circular list through the records' prev/next ids with the table's
+ * reserved slot 0 as the sentinel.
+ */
 class AgeList {
   public:
-    File *fs;
+    FileTable *ft;
+    uint32_t fs; // sentinel id
     size_t size;
     uint64_t count;
     uint64_t total_size;
 
-    AgeList(uint64_t size) {
-      fs = new File("0", 0, 0, 0);
-      fs->prev = fs;
-      fs->next = fs;
+    AgeList(FileTable *ft, uint64_t size) {
+      this->ft = ft;
+      fs = 0;
+      (*ft)[fs].prev = fs;
+      (*ft)[fs].next = fs;
       this->size = size;
+      count = 0;
+      total_size = 0;
     }
 
-    void addFile(File *f) {
-      f->next = fs;
-      f->prev = fs->prev;
-      fs->prev->next = f;
-      fs->prev = f;
+    void addFile(uint32_t id) {
+      auto &f = (*ft)[id];
+      auto &s = (*ft)[fs];
+      f.next = fs;
+      f.prev = s.prev;
+      (*ft)[s.prev].next = id;
+      s.prev = id;
       count++;
     }
 
-    void deleteFile(File *f) {
-      if(fs->next == f) {
-        fs->next = f->next;
-      } else if(fs->prev == f) {
-        fs->prev = f->prev;
-      }
-      f->prev->next = f->next;
-      f->next->prev = f->prev;
-      f->next = f->prev = NULL;
+    void deleteFile(uint32_t id) {
+      auto &f = (*ft)[id];
+      (*ft)[f.prev].next = f.next;
+      (*ft)[f.next].prev = f.prev;
+      f.next = f.prev = 0;
       count--;
     }
 };
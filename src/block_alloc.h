@@ -0,0 +1,597 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef BLOCK_ALLOC_
+#define BLOCK_ALLOC_
+/* a run of blocks */
+struct Extent {
+  uint64_t start;
+  uint64_t len;
+};
+
+/*
+ * BlockAllocator hands out the blocks of a simulated device (MemFs).
+ * Policies differ in which free blocks a file gets, which is what shapes
+ * free-space fragmentation as the image ages:
+ *
+ *   next-fit   continue after the file's last block, else after the last
+ *              allocation (the MemFs default)
+ *   first-fit  the lowest free run big enough
+ *   best-fit   the smallest free run big enough
+ *   buddy      power of two, naturally aligned runs, split and coalesced
+ *              with their buddies
+ *   ext4       block groups: a new file goes to its directory's group,
+ *              spills over into the next group with a big enough run
+ *
+ * alloc() returns one run of 1..want blocks (a file needing more calls
+ * it again with the end of what it got as goal) and only fails, with
+ * len 0, when no block is free.  If nothing is big enough a policy
+ * settles for its largest candidate, so files fragment as the disk
+ * fills.
+ *
+ * Every policy keeps its free space as runs and reports each run it adds
+ * or removes to addFree()/removeFree(), which keep the free run size
+ * histogram (by power of two) current at all times.  Not thread-safe,
+ * MemFs serializes all calls.
+ */
+class BlockAllocator {
+  public:
+    static const int CLASSES = 64;
+    static const uint64_t NO_GOAL = ~0ULL;
+
+    /* the device starts out as `blocks' free blocks */
+    BlockAllocator(uint64_t blocks) {
+      nblocks = blocks;
+      free_blocks = 0;
+      free_runs = 0;
+      std::fill(hist, hist + CLASSES, 0);
+    }
+
+    virtual ~BlockAllocator() {}
+
+    virtual Extent alloc(uint64_t want, uint64_t goal) = 0;
+    virtual void free(const Extent &e) = 0;
+
+    /* where a new file of the directory with this key should start */
+    virtual uint64_t dirGoal(uint64_t dir_key) {
+      (void) dir_key;
+      return NO_GOAL;
+    }
+
+    /* add n free blocks at the end of the device */
+    void grow(uint64_t n) {
+      auto start = nblocks;
+      nblocks += n;
+      free({start, n});
+    }
+
+    uint64_t blocks() const {
+      return nblocks;
+    }
+
+    uint64_t freeBlocks() const {
+      return free_blocks;
+    }
+
+    uint64_t freeRuns() const {
+      return free_runs;
+    }
+
+    /* free runs of [2^c, 2^(c+1)) blocks */
+    uint64_t freeRuns(int c) const {
+      return hist[c];
+    }
+
+    static int sizeClass(uint64_t len) {
+      return 63 - __builtin_clzll(len);
+    }
+
+    /* allocator for a policy name above, NULL if there is no such policy */
+    static BlockAllocator* create(const std::string &policy,
+        uint64_t blocks);
+
+  protected:
+    uint64_t nblocks;
+
+    void addFree(uint64_t len) {
+      hist[sizeClass(len)]++;
+      free_runs++;
+      free_blocks += len;
+    }
+
+    void removeFree(uint64_t len) {
+      hist[sizeClass(len)]--;
+      free_runs--;
+      free_blocks -= len;
+    }
+
+  private:
+    uint64_t free_blocks;
+    uint64_t free_runs;
+    uint64_t hist[CLASSES];
+};
+
+/*
+ * ExtentMapAllocator keeps free space as a map of maximal free runs
+ * (start -> length), coalescing on free, and leaves the choice of run to
+ * the policy.  Policies that need an index of their own maintain it in
+ * inserted()/erased().
+ */
+class ExtentMapAllocator : public BlockAllocator {
+  public:
+    typedef std::map<uint64_t, uint64_t>::iterator run_t;
+
+    ExtentMapAllocator(uint64_t blocks) : BlockAllocator(blocks) {
+    }
+
+    /* call from the most derived constructor, once the indexes exist */
+    void init() {
+      if(nblocks > 0) {
+        free({0, nblocks});
+      }
+    }
+
+    Extent alloc(uint64_t want, uint64_t goal) {
+      if(runs.empty()) {
+        return {0, 0};
+      }
+      uint64_t start;
+      auto it = choose(want, goal, start);
+      auto len = std::min(want, it->first + it->second - start);
+      take(it, start, len);
+      return {start, len};
+    }
+
+    void free(const Extent &e) {
+      auto start = e.start, end = e.start + e.len;
+      while(start < end) {
+        auto stop = std::min(end, barrier(start));
+        freeRun(start, stop - start);
+        start = stop;
+      }
+    }
+
+  protected:
+    std::map<uint64_t, uint64_t> runs; // free runs, start -> length
+
+    /*
+     * the free run to allocate from and where in it to start; it may be
+     * shorter than want.  runs is not empty.
+     */
+    virtual run_t choose(uint64_t want, uint64_t goal, uint64_t &start) = 0;
+
+    /* first block after b that a free run holding b must not reach */
+    virtual uint64_t barrier(uint64_t b) {
+      (void) b;
+      return NO_GOAL;
+    }
+
+    virtual void inserted(uint64_t start, uint64_t len) {
+      (void) start;
+      (void) len;
+    }
+
+    virtual void erased(uint64_t start, uint64_t len) {
+      (void) start;
+      (void) len;
+    }
+
+    /* the free run holding block b, runs.end() if b is not free */
+    run_t holding(uint64_t b) {
+      auto it = runs.upper_bound(b);
+      if(it == runs.begin()) {
+        return runs.end();
+      }
+      it = std::prev(it);
+      return (it->first + it->second > b) ? it : runs.end();
+    }
+
+  private:
+    bool mergeable(uint64_t b) {
+      return (b == 0) || (barrier(b - 1) != b);
+    }
+
+    /* free [start, start+len), which crosses no barrier */
+    void freeRun(uint64_t start, uint64_t len) {
+      auto next = runs.lower_bound(start);
+      if((next != runs.begin()) && mergeable(start)) {
+        auto prev = std::prev(next);
+        if(prev->first + prev->second == start) {
+          start = prev->first;
+          len += prev->second;
+          erase(prev);
+        }
+      }
+      if((next != runs.end()) && (start + len == next->first) &&
+          mergeable(next->first)) {
+        len += next->second;
+        erase(next);
+      }
+      insert(start, len);
+    }
+
+    void insert(uint64_t start, uint64_t len) {
+      runs[start] = len;
+      addFree(len);
+      inserted(start, len);
+    }
+
+    void erase(run_t it) {
+      auto start = it->first, len = it->second;
+      runs.erase(it);
+      removeFree(len);
+      erased(start, len);
+    }
+
+    /* carve [start, start+len) out of the free run at it */
+    void take(run_t it, uint64_t start, uint64_t len) {
+      auto rstart = it->first, rlen = it->second;
+      erase(it);
+      if(start > rstart) {
+        insert(rstart, start - rstart);
+      }
+      if(start + len < rstart + rlen) {
+        insert(start + len, rstart + rlen - start - len);
+      }
+    }
+};
+
+/*
+ * continue at the goal if it is free, otherwise at the next free run
+ * after it, or after the last allocation if there is no goal
+ */
+class NextFitAllocator : public ExtentMapAllocator {
+  public:
+    NextFitAllocator(uint64_t blocks) : ExtentMapAllocator(blocks) {
+      rover = 0;
+      init();
+    }
+
+  protected:
+    run_t choose(uint64_t want, uint64_t goal, uint64_t &start) {
+      auto from = (goal == NO_GOAL) ? rover : goal;
+      auto it = holding(from);
+      if(it != runs.end()) {
+        start = from;
+      } else {
+        it = runs.lower_bound(from);
+        if(it == runs.end()) {
+          it = runs.begin(); // wrap around
+        }
+        start = it->first;
+      }
+      rover = start + std::min(want, it->first + it->second - start);
+      return it;
+    }
+
+  private:
+    uint64_t rover; // where the last allocation ended
+};
+
+/*
+ * lowest free run that fits.  Runs are indexed by size class, each class
+ * ordered by start: every run in a class above want's fits, so only the
+ * lowest of each is a candidate, and want's own class is scanned in
+ * address order.  Without a fit, the lowest run of the largest class.
+ */
+class FirstFitAllocator : public ExtentMapAllocator {
+  public:
+    FirstFitAllocator(uint64_t blocks) : ExtentMapAllocator(blocks) {
+      init();
+    }
+
+  protected:
+    std::set<uint64_t> by_class[CLASSES];
+
+    run_t choose(uint64_t want, uint64_t goal, uint64_t &start) {
+      (void) goal;
+      int c = sizeClass(want);
+      auto best = NO_GOAL;
+      for(int k=c+1; k<CLASSES; k++) {
+        if(!by_class[k].empty()) {
+          best = std::min(best, *by_class[k].begin());
+        }
+      }
+      for(auto s : by_class[c]) {
+        if(s >= best) {
+          break;
+        }
+        if(runs.find(s)->second >= want) {
+          best = s;
+          break;
+        }
+      }
+      if(best == NO_GOAL) {
+        for(int k=c; k>=0; k--) {
+          if(!by_class[k].empty()) {
+            best = *by_class[k].begin();
+            break;
+          }
+        }
+      }
+      start = best;
+      return runs.find(best);
+    }
+
+    void inserted(uint64_t start, uint64_t len) {
+      by_class[sizeClass(len)].insert(start);
+    }
+
+    void erased(uint64_t start, uint64_t len) {
+      by_class[sizeClass(len)].erase(start);
+    }
+};
+
+/* smallest free run that fits (lowest first), else the largest one */
+class BestFitAllocator : public ExtentMapAllocator {
+  public:
+    BestFitAllocator(uint64_t blocks) : ExtentMapAllocator(blocks) {
+      init();
+    }
+
+  protected:
+    std::set<std::pair<uint64_t, uint64_t>> by_len; // (length, start)
+
+    run_t choose(uint64_t want, uint64_t goal, uint64_t &start) {
+      (void) goal;
+      auto it = by_len.lower_bound(std::make_pair(want, (uint64_t) 0));
+      if(it == by_len.end()) {
+        it = std::prev(it);
+      }
+      start = it->second;
+      return runs.find(start);
+    }
+
+    void inserted(uint64_t start, uint64_t len) {
+      by_len.insert(std::make_pair(len, start));
+    }
+
+    void erased(uint64_t start, uint64_t len) {
+      by_len.erase(std::make_pair(len, start));
+    }
+};
+
+/*
+ * ext4-like block groups of GROUP blocks.  Free runs never cross a group
+ * boundary.  A file starts in the group its directory hashes to and is
+ * placed at the first run there that fits, looking at the following
+ * groups in turn if none does; per-group counts of runs by size class
+ * tell which groups are worth scanning.  If no group can fit it, the
+ * file gets the largest run of the first group with free space.
+ */
+class GroupAllocator : public ExtentMapAllocator {
+  public:
+    static const uint64_t GROUP = 32768; // 128MB of 4K blocks, like ext4
+
+    GroupAllocator(uint64_t blocks) : ExtentMapAllocator(blocks) {
+      init();
+    }
+
+    uint64_t dirGoal(uint64_t dir_key) {
+      return (dir_key % groups()) * GROUP;
+    }
+
+  protected:
+    std::vector<std::vector<uint32_t>> group_hist; // runs by class
+
+    run_t choose(uint64_t want, uint64_t goal, uint64_t &start) {
+      auto it = (goal == NO_GOAL) ? runs.end() : holding(goal);
+      if((it != runs.end()) && (it->first + it->second - goal >= want)) {
+        start = goal; // the file can go on where it is
+        return it;
+      }
+      uint64_t g0 = (goal == NO_GOAL) ? 0 : std::min(goal / GROUP,
+          groups() - 1);
+      int c = sizeClass(want);
+      for(uint64_t i=0; i<groups(); i++) {
+        auto g = (g0 + i) % groups();
+        if(!mayFit(g, c)) {
+          continue;
+        }
+        for(it = runs.lower_bound(g * GROUP);
+            (it != runs.end()) && (it->first < (g + 1) * GROUP); it++) {
+          if(it->second >= want) {
+            start = it->first;
+            return it;
+          }
+        }
+      }
+      for(uint64_t i=0; i<groups(); i++) {
+        auto g = (g0 + i) % groups();
+        auto largest = runs.end();
+        for(it = runs.lower_bound(g * GROUP);
+            (it != runs.end()) && (it->first < (g + 1) * GROUP); it++) {
+          if((largest == runs.end()) || (it->second > largest->second)) {
+            largest = it;
+          }
+        }
+        if(largest != runs.end()) {
+          start = largest->first;
+          return largest;
+        }
+      }
+      assert(0); // runs is not empty
+      return runs.end();
+    }
+
+    uint64_t barrier(uint64_t b) {
+      return (b / GROUP + 1) * GROUP;
+    }
+
+    void inserted(uint64_t start, uint64_t len) {
+      auto g = start / GROUP;
+      if(g >= group_hist.size()) {
+        group_hist.resize(g + 1, std::vector<uint32_t>(CLASSES, 0));
+      }
+      group_hist[g][sizeClass(len)]++;
+    }
+
+    void erased(uint64_t start, uint64_t len) {
+      group_hist[start / GROUP][sizeClass(len)]--;
+    }
+
+  private:
+    uint64_t groups() const {
+      return std::max((uint64_t) 1, (nblocks + GROUP - 1) / GROUP);
+    }
+
+    /* may group g have a free run of at least 2^c blocks */
+    bool mayFit(uint64_t g, int c) {
+      if(g >= group_hist.size()) {
+        return false;
+      }
+      for(int k=c; k<CLASSES; k++) {
+        if(group_hist[g][k] > 0) {
+          return true;
+        }
+      }
+      return false;
+    }
+};
+
+/*
+ * Binary buddy allocator: free space is kept as naturally aligned blocks
+ * of 2^k blocks, one address-ordered set per order.  A request gets the
+ * largest power of two not above it, split off the lowest free block of
+ * the smallest order that has one (or the largest free block if none is
+ * big enough), so a file is a handful of aligned runs rather than one
+ * rounded-up block.  A freed run is cut into aligned blocks, each merged
+ * with its buddy as long as the buddy is free too.  Adjacent free blocks
+ * that are not buddies are still one run of free space, so the free run
+ * histogram comes from a map of the maximal free runs kept alongside,
+ * the same runs the other policies report.
+ */
+class BuddyAllocator : public BlockAllocator {
+  public:
+    BuddyAllocator(uint64_t blocks) : BlockAllocator(blocks) {
+      if(blocks > 0) {
+        free({0, blocks});
+      }
+    }
+
+    Extent alloc(uint64_t want, uint64_t goal) {
+      (void) goal;
+      int k = sizeClass(want);
+      int o = k;
+      while((o < CLASSES) && free_order[o].empty()) {
+        o++;
+      }
+      if(o == CLASSES) {
+        for(o=k-1; (o >= 0) && free_order[o].empty(); o--) {
+        }
+        if(o < 0) {
+          return {0, 0};
+        }
+        k = o;
+      }
+      auto start = *free_order[o].begin();
+      remove(start, o);
+      while(o > k) { // split, keep the low half
+        o--;
+        add(start + (1ULL << o), o);
+      }
+      return {start, 1ULL << k};
+    }
+
+    void free(const Extent &e) {
+      auto start = e.start, end = e.start + e.len;
+      while(start < end) {
+        int o = start ? __builtin_ctzll(start) : CLASSES - 1;
+        while((o > 0) && (start + (1ULL << o) > end)) {
+          o--;
+        }
+        release(start, o);
+        start += 1ULL << o;
+      }
+    }
+
+  private:
+    std::set<uint64_t> free_order[CLASSES];
+    std::map<uint64_t, uint64_t> runs; // maximal free runs, start -> length
+
+    void add(uint64_t start, int o) {
+      free_order[o].insert(start);
+      uint64_t len = 1ULL << o;
+      auto next = runs.lower_bound(start);
+      if(next != runs.begin()) {
+        auto prev = std::prev(next);
+        if(prev->first + prev->second == start) {
+          start = prev->first;
+          len += prev->second;
+          removeFree(prev->second);
+          runs.erase(prev);
+        }
+      }
+      if((next != runs.end()) && (start + len == next->first)) {
+        len += next->second;
+        removeFree(next->second);
+        runs.erase(next);
+      }
+      runs[start] = len;
+      addFree(len);
+    }
+
+    void remove(uint64_t start, int o) {
+      free_order[o].erase(start);
+      uint64_t len = 1ULL << o;
+      auto it = std::prev(runs.upper_bound(start));
+      auto rstart = it->first, rlen = it->second;
+      removeFree(rlen);
+      runs.erase(it);
+      if(start > rstart) {
+        runs[rstart] = start - rstart;
+        addFree(start - rstart);
+      }
+      if(start + len < rstart + rlen) {
+        runs[start + len] = rstart + rlen - start - len;
+        addFree(rstart + rlen - start - len);
+      }
+    }
+
+    void release(uint64_t start, int o) {
+      while(o < CLASSES - 1) {
+        uint64_t buddy = start ^ (1ULL << o);
+        if((buddy + (1ULL << o) > nblocks) ||
+            (free_order[o].count(buddy) == 0)) {
+          break;
+        }
+        remove(buddy, o);
+        start = std::min(start, buddy);
+        o++;
+      }
+      add(start, o);
+    }
+};
+
+inline BlockAllocator* BlockAllocator::create(const std::string &policy,
+    uint64_t blocks) {
+  if(policy == "next-fit") {
+    return new NextFitAllocator(blocks);
+  } else if(policy == "first-fit") {
+    return new FirstFitAllocator(blocks);
+  } else if(policy == "best-fit") {
+    return new BestFitAllocator(blocks);
+  } else if(policy == "buddy") {
+    return new BuddyAllocator(blocks);
+  } else if(policy == "ext4") {
+    return new GroupAllocator(blocks);
+  }
+  return NULL;
+}
+#endif  /* BLOCK_ALLOC_ */
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#ifndef BLOCK_BITMAP_
+#define BLOCK_BITMAP_
+/*
+ * BlockBitmap is a compressed set of block numbers (roaring style): the
+ * block space is cut into chunks of 2^16 blocks and only chunks with a
+ * block in them exist.  A chunk holds a sorted array of the low 16 bits
+ * of its blocks while it has few of them and switches to a plain 8KB
+ * bitmap once the array would be bigger than that, so a sparse set costs
+ * 2 bytes a block and a dense one 1 bit.  Blocks can be added in any
+ * order; forEachExtent() hands them back as runs of adjacent blocks in
+ * increasing order.
+ */
+class BlockBitmap {
+  public:
+    static const int CHUNK_BITS = 16;
+    static const uint32_t CHUNK = 1 << CHUNK_BITS;
+    static const size_t MAX_ARRAY = CHUNK / 16; // then a bitmap is smaller
+
+    BlockBitmap() {
+      nblocks = 0;
+    }
+
+    void add(uint64_t block) {
+      addRange(block, 1);
+    }
+
+    /* add blocks [start, start+len) */
+    void addRange(uint64_t start, uint64_t len) {
+      while(len > 0) {
+        auto &c = chunks[start >> CHUNK_BITS];
+        uint32_t lo = start & (CHUNK - 1);
+        uint32_t n = (uint32_t) std::min((uint64_t) (CHUNK - lo), len);
+        nblocks += c.addRange(lo, n);
+        start += n;
+        len -= n;
+      }
+    }
+
+    bool contains(uint64_t block) const {
+      auto it = chunks.find(block >> CHUNK_BITS);
+      return (it != chunks.end()) &&
+        it->second.contains(block & (CHUNK - 1));
+    }
+
+    /* add every block of other */
+    void merge(const BlockBitmap &other) {
+      other.forEachExtent([this](uint64_t start, uint64_t len) {
+        addRange(start, len);
+      });
+    }
+
+    uint64_t count() const {
+      return nblocks;
+    }
+
+    /* bytes of memory the set takes, roughly */
+    size_t bytes() const {
+      size_t b = 0;
+      for(auto &e : chunks) {
+        b += sizeof(e) + e.second.bytes();
+      }
+      return b;
+    }
+
+    /* fn(start, len) for every maximal run of blocks, lowest first */
+    template <class F>
+    void forEachExtent(F fn) const {
+      uint64_t start = 0, len = 0;
+      for(auto &e : chunks) {
+        uint64_t base = e.first << CHUNK_BITS;
+        e.second.forEachRun([&](uint32_t lo, uint32_t n) {
+          if((len > 0) && (start + len == base + lo)) {
+            len += n;
+            return;
+          }
+          if(len > 0) {
+            fn(start, len);
+          }
+          start = base + lo;
+          len = n;
+        });
+      }
+      if(len > 0) {
+        fn(start, len);
+      }
+    }
+
+  private:
+    class Chunk {
+      public:
+        /* blocks that were not there yet */
+        uint32_t addRange(uint32_t lo, uint32_t n) {
+          if(bits.empty() && (array.size() + n > MAX_ARRAY)) {
+            toBitmap();
+          }
+          if(!bits.empty()) {
+            uint32_t added = 0;
+            for(auto b = lo; b < lo + n; b++) {
+              auto &w = bits[b >> 6];
+              uint64_t m = 1ULL << (b & 63);
+              added += !(w & m);
+              w |= m;
+            }
+            return added;
+          }
+          // merge [lo, lo+n) into the sorted array
+          auto first = std::lower_bound(array.begin(), array.end(),
+              (uint16_t) lo);
+          auto last = std::lower_bound(first, array.end(),
+              (uint32_t) lo + n, [](uint16_t v, uint32_t key) {
+                return v < key;
+              });
+          uint32_t present = last - first;
+          std::vector<uint16_t> run(n);
+          for(uint32_t i=0; i<n; i++) {
+            run[i] = lo + i;
+          }
+          auto at = array.erase(first, last);
+          array.insert(at, run.begin(), run.end());
+          return n - present;
+        }
+
+        bool contains(uint32_t lo) const {
+          if(!bits.empty()) {
+            return bits[lo >> 6] & (1ULL << (lo & 63));
+          }
+          return std::binary_search(array.begin(), array.end(),
+              (uint16_t) lo);
+        }
+
+        size_t bytes() const {
+          return array.capacity() * sizeof(uint16_t) +
+            bits.capacity() * sizeof(uint64_t);
+        }
+
+        template <class F>
+        void forEachRun(F fn) const {
+          if(bits.empty()) {
+            for(size_t i=0; i<array.size(); ) {
+              size_t j = i + 1;
+              while((j < array.size()) &&
+                  (array[j] == array[j-1] + 1)) {
+                j++;
+              }
+              fn(array[i], j - i);
+              i = j;
+            }
+            return;
+          }
+          uint32_t b = 0;
+          while(b < CHUNK) {
+            b = nextBit(b, true);
+            if(b == CHUNK) {
+              break;
+            }
+            auto e = nextBit(b, false);
+            fn(b, e - b);
+            b = e;
+          }
+        }
+
+      private:
+        std::vector<uint16_t> array; // sorted, while small
+        std::vector<uint64_t> bits; // CHUNK bits, once big
+
+        void toBitmap() {
+          bits.assign(CHUNK / 64, 0);
+          for(auto v : array) {
+            bits[v >> 6] |= 1ULL << (v & 63);
+          }
+          std::vector<uint16_t>().swap(array);
+        }
+
+        /* first bit at or after b that is set (or clear), CHUNK if none */
+        uint32_t nextBit(uint32_t b, bool set) const {
+          while(b < CHUNK) {
+            uint64_t w = bits[b >> 6];
+            if(!set) {
+              w = ~w;
+            }
+            w &= ~0ULL << (b & 63);
+            if(w) {
+              return (b & ~63U) + __builtin_ctzll(w);
+            }
+            b = (b & ~63U) + 64;
+          }
+          return CHUNK;
+        }
+    };
+
+    std::map<uint64_t, Chunk> chunks; // by block >> CHUNK_BITS
+    uint64_t nblocks;
+};
+#endif  /* BLOCK_BITMAP_ */
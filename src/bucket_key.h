@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <stdint.h>
+
+#ifndef BUCKET_KEY_
+#define BUCKET_KEY_
+/*
+ * Ordering key for age, size and dir buckets. Buckets are ranked by how
+ * far they are from their ideal fraction (deviation), ties are broken by
+ * the bucket's id (bucket id for ages, size for sizes, depth for dirs).
+ */
+struct BucketKey {
+  double deviation;
+  uint64_t id;
+
+  BucketKey() {
+    deviation = 0.0;
+    id = 0;
+  }
+
+  BucketKey(uint64_t id, double deviation) {
+    this->id = id;
+    this->deviation = deviation;
+  }
+
+  bool operator<(const BucketKey &k) const {
+    if(deviation < k.deviation) {
+      return true;
+    } else if((deviation == k.deviation) && (id < k.id)) {
+      return true;
+    }
+    return false;
+  }
+
+  bool operator==(const BucketKey &k) const {
+    return (deviation == k.deviation) && (id == k.id);
+  }
+};
+#endif  /* BUCKET_KEY_ */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <assert.h>
+#include <vector>
+
+#include "bucket_key.h"
+#include "fit_tracker.h"
+
+#ifndef BUCKET_RANK_
+#define BUCKET_RANK_
+/*
+ * BucketRank keeps a set of buckets addressed by their id together with
+ * a ranking of those ids in ascending BucketKey order.  All storage is
+ * sized once by add() at init time, so re-ranking never allocates.
+ *
+ * A change in live_file_count moves every bucket's actual_fraction, and
+ * since buckets have different ideal fractions the relative order of
+ * their deviations can change too.  reRank() therefore refreshes every
+ * key and then repairs the previous ranking with an insertion sort, which
+ * costs O(B) plus one step per pair of buckets that swapped places (the
+ * ranking is almost always already sorted).
+ *
+ * Every change to a bucket's count goes through add(), update() or
+ * reRank(), so `fit' follows the counts and tells at any time how well
+ * they match the ideal fractions.
+ */
+template <class T>
+class BucketRank {
+  public:
+    std::vector<T> buckets; // buckets indexed by id
+    std::vector<BucketKey> keys; // current key of each bucket id
+    std::vector<int> rank; // bucket ids in ascending key order
+    FitTracker fit; // chi-squared distance of the counts from the ideal
+
+    void add(const T &b) {
+      assert(b.id == (int) buckets.size());
+      buckets.push_back(b);
+      keys.push_back(buckets.back().getKey());
+      rank.push_back(b.id);
+      fit.add(b.ideal_fraction);
+      fit.set(b.id, b.count);
+      sort();
+    }
+
+    size_t size() const {
+      return buckets.size();
+    }
+
+    /* bucket by id */
+    T& operator[](int id) {
+      return buckets[id];
+    }
+
+    /* bucket by rank, 0 being the smallest key */
+    T& at(size_t position) {
+      return buckets[rank[position]];
+    }
+
+    /* refresh the key of a bucket whose fraction changed on its own */
+    void update(int id) {
+      keys[id] = buckets[id].getKey();
+      fit.set(id, buckets[id].count);
+      sort();
+    }
+
+    void reRank(uint64_t live_file_count) {
+      for(size_t i=0; i<buckets.size(); i++) {
+        buckets[i].reKey(live_file_count);
+        keys[i] = buckets[i].getKey();
+        fit.set(i, buckets[i].count);
+      }
+      sort();
+    }
+
+    void clear() {
+      std::vector<T>().swap(buckets);
+      std::vector<BucketKey>().swap(keys);
+      std::vector<int>().swap(rank);
+      fit.clear();
+    }
+
+    /* catch fit up with counts that were set directly, e.g. restored */
+    void refit() {
+      for(size_t i=0; i<buckets.size(); i++) {
+        fit.set(i, buckets[i].count);
+      }
+      fit.recompute();
+    }
+
+  private:
+    void sort() {
+      for(size_t i=1; i<rank.size(); i++) {
+        auto id = rank[i];
+        auto j = i;
+        while((j > 0) && (keys[id] < keys[rank[j-1]])) {
+          rank[j] = rank[j-1];
+          j--;
+        }
+        rank[j] = id;
+      }
+    }
+};
+#endif  /* BUCKET_RANK_ */
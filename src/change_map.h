@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "block_bitmap.h"
+
+#ifndef CHANGE_MAP_
+#define CHANGE_MAP_
+/*
+ * ChangeMap tracks which 4K blocks of the device under the aged file
+ * system a run touches, so rollback can reset it to the golden image it
+ * started from without blktrace.  It holds two sets of blocks:
+ *
+ *   changed  the data extents of every file created or deleted, found
+ *            with FIEMAP while the file is open
+ *   base     the data extents of the files that were there when tracking
+ *            started, i.e. the golden image's file data
+ *
+ * FIEMAP only knows file data, not the file system's own metadata
+ * (inodes, allocation bitmaps, directories, the journal), so a block that
+ * differs from the golden image is either in changed or outside base;
+ * rollback copies the first and compares the rest.  That holds as long as
+ * the golden image's files are only deleted through Geriatrix.
+ *
+ * The map file is "gerichg1", then per set a varint set id (1 changed,
+ * 2 base), a varint number of extents and, for each extent in block
+ * order, varints of its distance from the end of the previous one and
+ * its length, in blocks.  Thread-safe.
+ */
+class ChangeMap {
+  public:
+    static const uint64_t MAGIC = 0x3167686369726567ULL; // "gerichg1"
+    static const uint64_t BLOCK = 4096;
+    enum set_t { CHANGED = 1, BASE = 2 };
+
+    BlockBitmap changed;
+    BlockBitmap base;
+
+    /* add the extents of the open file fd to a set, 0 or -1 (errno) */
+    int addFile(int fd, set_t set = CHANGED) {
+      const int N = 64; // extents per FIEMAP call
+      std::vector<char> buf(sizeof(struct fiemap) +
+          N * sizeof(struct fiemap_extent));
+      auto fm = (struct fiemap *) buf.data();
+      uint64_t start = 0;
+      while(1) {
+        memset(fm, 0, sizeof(*fm));
+        fm->fm_start = start;
+        fm->fm_length = FIEMAP_MAX_OFFSET - start;
+        fm->fm_extent_count = N;
+        if(ioctl(fd, FS_IOC_FIEMAP, fm) < 0) {
+          return -1;
+        }
+        if(fm->fm_mapped_extents == 0) {
+          return 0;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &blocks = (set == CHANGED) ? changed : base;
+        for(uint32_t i=0; i<fm->fm_mapped_extents; i++) {
+          auto &e = fm->fm_extents[i];
+          // nowhere on the device yet, or stored with the metadata
+          if(!(e.fe_flags & (FIEMAP_EXTENT_UNKNOWN |
+                  FIEMAP_EXTENT_DATA_INLINE)) && (e.fe_length > 0)) {
+            uint64_t first = e.fe_physical / BLOCK;
+            uint64_t end = (e.fe_physical + e.fe_length + BLOCK - 1) / BLOCK;
+            blocks.addRange(first, end - first);
+          }
+          if(e.fe_flags & FIEMAP_EXTENT_LAST) {
+            return 0;
+          }
+          start = e.fe_logical + e.fe_length;
+        }
+      }
+    }
+
+    /* write the map to path.tmp and rename it over path */
+    int save(const std::string &path) {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<uint8_t> out;
+      uint64_t magic = MAGIC;
+      out.insert(out.end(), (uint8_t *) &magic, (uint8_t *) (&magic + 1));
+      putSet(out, CHANGED, changed);
+      putSet(out, BASE, base);
+      auto tmp = path + ".tmp";
+      FILE *fp = fopen(tmp.c_str(), "w");
+      if(fp == NULL) {
+        return -1;
+      }
+      bool failed = (fwrite(out.data(), 1, out.size(), fp) != out.size());
+      failed |= (fflush(fp) != 0) || (fsync(fileno(fp)) != 0);
+      failed |= (fclose(fp) != 0);
+      if(failed) {
+        unlink(tmp.c_str());
+        return -1;
+      }
+      return rename(tmp.c_str(), path.c_str());
+    }
+
+    /* 0, or -1 with errno set (EINVAL if it is not a map) */
+    int load(const std::string &path) {
+      FILE *fp = fopen(path.c_str(), "r");
+      if(fp == NULL) {
+        return -1;
+      }
+      std::vector<uint8_t> in;
+      uint8_t buf[65536];
+      size_t n;
+      while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        in.insert(in.end(), buf, buf + n);
+      }
+      bool failed = ferror(fp);
+      fclose(fp);
+      if(failed) {
+        return -1;
+      }
+      uint64_t magic = 0;
+      if(in.size() >= sizeof(magic)) {
+        memcpy(&magic, in.data(), sizeof(magic));
+      }
+      if(magic != MAGIC) {
+        errno = EINVAL;
+        return -1;
+      }
+      const uint8_t *pos = in.data() + sizeof(magic), *end = pos + in.size() -
+        sizeof(magic);
+      while(pos < end) {
+        uint64_t set, count;
+        if(!getVarint(pos, end, set) || !getVarint(pos, end, count) ||
+            ((set != CHANGED) && (set != BASE))) {
+          errno = EINVAL;
+          return -1;
+        }
+        auto &blocks = (set == CHANGED) ? changed : base;
+        uint64_t at = 0;
+        for(uint64_t i=0; i<count; i++) {
+          uint64_t gap, len;
+          if(!getVarint(pos, end, gap) || !getVarint(pos, end, len)) {
+            errno = EINVAL;
+            return -1;
+          }
+          blocks.addRange(at + gap, len);
+          at += gap + len;
+        }
+      }
+      return 0;
+    }
+
+  private:
+    std::mutex mutex;
+
+    static void putVarint(std::vector<uint8_t> &out, uint64_t v) {
+      while(v >= 0x80) {
+        out.push_back((uint8_t) (v | 0x80));
+        v >>= 7;
+      }
+      out.push_back((uint8_t) v);
+    }
+
+    static bool getVarint(const uint8_t *&pos, const uint8_t *end,
+        uint64_t &v) {
+      v = 0;
+      for(int shift = 0; (shift < 64) && (pos < end); shift += 7) {
+        uint8_t b = *pos++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    static void putSet(std::vector<uint8_t> &out, set_t set,
+        const BlockBitmap &blocks) {
+      std::vector<std::pair<uint64_t, uint64_t>> extents;
+      blocks.forEachExtent([&extents](uint64_t start, uint64_t len) {
+        extents.push_back(std::make_pair(start, len));
+      });
+      putVarint(out, set);
+      putVarint(out, extents.size());
+      uint64_t at = 0;
+      for(auto &e : extents) {
+        putVarint(out, e.first - at);
+        putVarint(out, e.second);
+        at = e.first + e.second;
+      }
+    }
+};
+#endif  /* CHANGE_MAP_ */
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#ifndef CHECKPOINT_
+#define CHECKPOINT_
+/*
+ * CheckpointFile is the binary stream the aging model is saved to and
+ * reloaded from.  Values are written in host byte order (a checkpoint is
+ * only meant to be resumed on the machine that wrote it).  The first
+ * failed read or write sticks in `failed', so callers stream everything
+ * and check once at the end.  A checkpoint is written to path.tmp and
+ * renamed over path when complete, so path always holds a whole one.
+ */
+class CheckpointFile {
+  public:
+    static const uint64_t MAGIC = 0x31706b6369726567ULL; // "gerickp1"
+
+    FILE *fp;
+    bool failed;
+    std::string path;
+
+    CheckpointFile() {
+      fp = NULL;
+      failed = false;
+    }
+
+    ~CheckpointFile() {
+      if(fp) {
+        fclose(fp);
+      }
+    }
+
+    int openWrite(const std::string &path) {
+      this->path = path;
+      fp = fopen((path + ".tmp").c_str(), "w");
+      return fp ? 0 : -1;
+    }
+
+    int openRead(const std::string &path) {
+      this->path = path;
+      fp = fopen(path.c_str(), "r");
+      return fp ? 0 : -1;
+    }
+
+    /* finish a checkpoint being written and move it into place */
+    int commit() {
+      if(fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        failed = true;
+      }
+      if(fclose(fp) != 0) {
+        failed = true;
+      }
+      fp = NULL;
+      if(failed) {
+        unlink((path + ".tmp").c_str());
+        return -1;
+      }
+      return rename((path + ".tmp").c_str(), path.c_str());
+    }
+
+    template <class T>
+    void put(const T &v) {
+      putArray(&v, 1);
+    }
+
+    template <class T>
+    void get(T &v) {
+      getArray(&v, 1);
+    }
+
+    template <class T>
+    void putArray(const T *v, size_t n) {
+      if(!failed && (n > 0) && (fwrite(v, sizeof(T), n, fp) != n)) {
+        failed = true;
+      }
+    }
+
+    template <class T>
+    void getArray(T *v, size_t n) {
+      if(!failed && (n > 0) && (fread(v, sizeof(T), n, fp) != n)) {
+        failed = true;
+      }
+    }
+
+    template <class T>
+    void putVector(const std::vector<T> &v) {
+      put((uint64_t) v.size());
+      putArray(v.data(), v.size());
+    }
+
+    template <class T>
+    void getVector(std::vector<T> &v) {
+      uint64_t n = 0;
+      get(n);
+      if(failed) {
+        return;
+      }
+      v.resize(n);
+      getArray(v.data(), n);
+    }
+
+    void putString(const std::string &s) {
+      put((uint64_t) s.size());
+      putArray(s.data(), s.size());
+    }
+
+    void getString(std::string &s) {
+      uint64_t n = 0;
+      get(n);
+      if(failed || (n > (1 << 20))) {
+        failed = true;
+        return;
+      }
+      s.resize(n);
+      getArray(&s[0], n);
+    }
+};
+#endif  /* CHECKPOINT_ */
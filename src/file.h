@@ -8,88 +8,62 @@
  */
 
 #include <iostream>
+#include <stdint.h>
 
 #ifndef FILE_
 #define FILE_
+/*
+ * File is the in-memory record of one live file.  Records are kept in a
+ * FileTable and refer to each other by 32-bit id, id 0 being the "no
+ * file" value.  The size and depth come from the size and dir buckets
+ * and the path is rebuilt on demand from the dir bucket prefix, the
+ * sibling dir and the age, so a record is only 32 bytes.
+ */
 class File {
   public:
-    size_t size;
-    std::string path;
-    uint64_t age;
-    int depth; // id of the dir_bucket_keys
-    File *prev;
-    File *next;
-    File *size_next;
-    File *size_prev;
-    File *dir_next;
-    File *dir_prev;
-    size_t blk_size;
-    long blk_count;
+    uint64_t age; // tick at which the file was created (also its name)
+    uint32_t prev; // next older file in the global age list
+    uint32_t next; // next younger file in the global age list
+    uint32_t cell_index; // position in its FileCell's file vector
+    uint16_t size_id; // id of the SizeBucket this file belongs to
+    uint16_t dir_id; // id of the DirBucket this file belongs to
+    uint32_t subdir; // sibling dir the file lives in (0 for none)
 
-    File(const char *name) {
-      this->path = name;
-      this->size = 0;
-      this->age = 0;
-      this->depth = 0;
-      this->prev = this->next = NULL;
-      this->size_next = this->size_prev = NULL;
-      this->dir_next = this->dir_prev = NULL;
+    File() {
+      age = 0;
+      prev = next = 0;
+      cell_index = 0;
+      size_id = dir_id = 0;
+      subdir = 0;
     }
 
-    File(const char *name, size_t size, uint64_t age, int depth) {
-      this->path = name;
-      this->size = size;
-      this->age = age;
-      this->prev = this->next = NULL;
-      this->size_next = this->size_prev = NULL;
-      if(this->size == 0) {
-        this->blk_size = 4096;
-        this->blk_count = 0;
-      } else if(this->size >= 4096) {
-        this->blk_size = 4096;
-        this->blk_count = this->size / 4096;
-      } else if(this->size >= 1024) {
-        this->blk_size = 1024;
-        this->blk_count = this->size / 1024;
-      } else {
-        this->blk_size = this->size;
-        this->blk_count = 1;
+    /*
+     * bytes actually allocated for a file of the given size: whole 4K
+     * blocks, whole 1K blocks or the exact size for tiny files.
+     */
+    static size_t allocSize(size_t size) {
+      if(size >= 4096) {
+        return (size / 4096) * 4096;
+      } else if(size >= 1024) {
+        return (size / 1024) * 1024;
       }
-      this->depth = depth;
-      this->dir_next = this->dir_prev = NULL;
+      return size;
     }
 
+    size_t getSize() const;
+    int getDepth() const;
+    int getPath(char *buf, size_t len) const;
+
     int createFile();
     int deleteFile();
     int accessFile();
 
-    void operator=(const File &f) {
-      size = f.size;
-      path = f.path;
-      age = f.age;
-      depth = f.depth;
-      blk_size = f.blk_size;
-      blk_count = f.blk_count;
-      prev = NULL;
-      next = NULL;
-      size_next = NULL;
-      size_prev = NULL;
-      dir_next = NULL;
-      dir_prev = NULL;
-    }
-
-    bool operator<(File f) const {
-      if(this->age < f.age) {
-        return true;
-      }
-      return false;
-    }
-
     friend std::ostream& operator<< (std::ostream &out, const File &f) {
-      out << "(path = " << f.path << ", age = " << f.age << ", size = " <<
-        f.size << ", depth = " << f.depth << ")";
+      char path[4096];
+      f.getPath(path, sizeof(path));
+      out << "(path = " << path << ", age = " << f.age << ", size = " <<
+        f.getSize() << ", depth = " << f.getDepth() << ")";
       return out;
     }
 };
-
 #endif
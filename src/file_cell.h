@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <assert.h>
+#include <vector>
+#include <boost/random.hpp>
+
+#include "file_table.h"
+
+#ifndef FILE_CELL_
+#define FILE_CELL_
+/*
+ * FileCell holds the ids of the live files of one age x size x dir
+ * combination.  Ids are kept densely packed in no particular order so
+ * that a random victim can be picked in O(1); each File remembers its
+ * slot in cell_index so it can be swapped out in O(1) as well.
+ */
+class FileCell {
+  public:
+    std::vector<uint32_t> files;
+
+    uint64_t count() const {
+      return files.size();
+    }
+
+    void addFile(FileTable &ft, uint32_t id) {
+      ft[id].cell_index = files.size();
+      files.push_back(id);
+    }
+
+    void deleteFile(FileTable &ft, uint32_t id) {
+      auto &f = ft[id];
+      assert(!files.empty());
+      assert(files[f.cell_index] == id);
+      /* swap the last file into f's slot so the vector stays dense */
+      auto last = files.back();
+      files[f.cell_index] = last;
+      ft[last].cell_index = f.cell_index;
+      files.pop_back();
+      f.cell_index = 0;
+    }
+
+    uint32_t getFileToDelete(boost::random::mt19937 &gen) {
+      if(files.empty()) {
+        return 0;
+      }
+      boost::random::uniform_int_distribution<uint64_t> dist{0,
+        files.size() - 1};
+      return files[dist(gen)];
+    }
+};
+#endif  /* FILE_CELL_ */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+
+#include "file.h"
+
+#ifndef FILE_TABLE_
+#define FILE_TABLE_
+static_assert(sizeof(File) <= 32, "File records should stay compact");
+
+/*
+ * FileTable is the arena holding every File record, indexed by file id.
+ * Records are carved out of fixed size chunks that are never moved, so
+ * File references stay valid across alloc() and growing the arena never
+ * copies existing records.  Slot 0 is never handed out: it doubles as
+ * the sentinel of the global age list.  Released slots are chained
+ * through their next field and reused first, so the arena only grows to
+ * the peak live file count.  clear() drops every chunk at once.
+ */
+class FileTable {
+  public:
+    static const int CHUNK_SHIFT = 16;
+    static const uint32_t CHUNK_FILES = (1U << CHUNK_SHIFT);
+
+    std::vector<File *> chunks;
+    uint32_t next_id; // first never used slot
+    uint32_t free_head; // first released slot, 0 if none
+    uint64_t live; // slots currently handed out
+    uint64_t high_water; // largest value live has reached
+
+    FileTable() {
+      next_id = 0;
+      free_head = 0;
+      live = 0;
+      high_water = 0;
+      newSlot(); // reserve slot 0
+    }
+
+    ~FileTable() {
+      clear();
+    }
+
+    File& operator[](uint32_t id) {
+      return chunks[id >> CHUNK_SHIFT][id & (CHUNK_FILES - 1)];
+    }
+
+    uint32_t alloc() {
+      uint32_t id;
+      if(free_head != 0) {
+        id = free_head;
+        free_head = (*this)[id].next;
+        (*this)[id] = File();
+      } else {
+        id = newSlot();
+      }
+      live++;
+      if(live > high_water) {
+        high_water = live;
+      }
+      return id;
+    }
+
+    void release(uint32_t id) {
+      assert(id != 0);
+      assert(live > 0);
+      (*this)[id].next = free_head;
+      free_head = id;
+      live--;
+    }
+
+    /* number of records the arena can hold without growing */
+    uint64_t capacity() const {
+      return (uint64_t) chunks.size() * CHUNK_FILES;
+    }
+
+    uint64_t bytes() const {
+      return capacity() * sizeof(File);
+    }
+
+    /* size the arena for next_id records, e.g. to reload a checkpoint */
+    void restore(uint32_t next_id, uint32_t free_head, uint64_t live,
+        uint64_t high_water) {
+      clear();
+      while(capacity() < next_id) {
+        chunks.push_back(new File[CHUNK_FILES]);
+      }
+      this->next_id = next_id;
+      this->free_head = free_head;
+      this->live = live;
+      this->high_water = high_water;
+    }
+
+    void clear() {
+      for(auto c : chunks) {
+        delete [] c;
+      }
+      chunks.clear();
+      next_id = 0;
+      free_head = 0;
+      live = 0;
+    }
+
+  private:
+    uint32_t newSlot() {
+      assert(next_id < UINT32_MAX);
+      if((next_id >> CHUNK_SHIFT) == chunks.size()) {
+        chunks.push_back(new File[CHUNK_FILES]);
+      }
+      return next_id++;
+    }
+};
+#endif  /* FILE_TABLE_ */
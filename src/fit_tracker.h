@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#ifndef FIT_TRACKER_
+#define FIT_TRACKER_
+/*
+ * FitTracker measures how far the file counts of a set of buckets are from
+ * their ideal fractions, with the chi-squared distance
+ *
+ *   chi2 = sum_i (e_i - c_i / n)^2 / e_i
+ *
+ * (e_i the ideal fraction of bucket i, c_i its count, n the total).  It
+ * expands to sum_i e_i - 2 sum_i c_i / n + (sum_i c_i^2 / e_i) / n^2, and
+ * those three sums are kept as counts change, so a check is O(1) however
+ * many buckets there are.  Buckets with an ideal fraction of 0 are left
+ * out of the sums (they would only divide by zero).  The ideal fractions,
+ * their inverses and the counts live in one contiguous array each.
+ */
+class FitTracker {
+  public:
+    FitTracker() {
+      clear();
+    }
+
+    /* add bucket number size() with the given ideal fraction */
+    void add(double ideal_fraction) {
+      ideal.push_back(ideal_fraction);
+      weight.push_back((ideal_fraction > 0) ? 1 / ideal_fraction : 0);
+      counts.push_back(0);
+      if(ideal_fraction > 0) {
+        ideal_sum += ideal_fraction;
+      }
+    }
+
+    size_t size() const {
+      return counts.size();
+    }
+
+    /* bucket i now holds count files */
+    void set(int i, uint64_t count) {
+      auto old = counts[i];
+      if(count == old) {
+        return;
+      }
+      counts[i] = count;
+      total += count - old;
+      if(weight[i] > 0) {
+        covered += count - old;
+        // c^2 - old^2 as (c - old) * (c + old) to stay exact for big counts
+        weighted += ((double) (int64_t) (count - old)) *
+          ((double) count + old) * weight[i];
+      }
+    }
+
+    uint64_t count(int i) const {
+      return counts[i];
+    }
+
+    double idealFraction(int i) const {
+      return ideal[i];
+    }
+
+    double chiSquared() const {
+      if(total == 0) {
+        return ideal_sum;
+      }
+      double n = total;
+      return std::max(0.0, ideal_sum - 2 * (covered / n) +
+          weighted / (n * n));
+    }
+
+    /* redo the sums from the counts, dropping their rounding errors */
+    double recompute() {
+      total = covered = 0;
+      weighted = 0;
+      for(size_t i=0; i<counts.size(); i++) {
+        total += counts[i];
+        if(weight[i] > 0) {
+          covered += counts[i];
+          weighted += (double) counts[i] * counts[i] * weight[i];
+        }
+      }
+      return chiSquared();
+    }
+
+    void clear() {
+      std::vector<double>().swap(ideal);
+      std::vector<double>().swap(weight);
+      std::vector<uint64_t>().swap(counts);
+      ideal_sum = 0;
+      weighted = 0;
+      total = covered = 0;
+    }
+
+  private:
+    std::vector<double> ideal; // e_i
+    std::vector<double> weight; // 1 / e_i, 0 if e_i is 0
+    std::vector<uint64_t> counts; // c_i
+    double ideal_sum; // sum of e_i
+    double weighted; // sum of c_i^2 / e_i
+    uint64_t total; // n
+    uint64_t covered; // sum of c_i with e_i > 0
+};
+#endif  /* FIT_TRACKER_ */
@@ -58,6 +58,45 @@ static struct backend_driver posix_backend_driver = {
     open, close, write, access, unlink, mkdir, posix_fallocate, stat, chmod,
 };
 
+/* memfs driver: an in-process simulated file system, see memfs.h */
+static MemFs *memfs = NULL;
+
+static int memfs_open(const char *path, int flags, ...) {
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    return(memfs->open(path, flags, mode));
+}
+static int memfs_close(int fd) { return(memfs->close(fd)); }
+static ssize_t memfs_write(int fd, const void *buf, size_t nbytes) {
+    return(memfs->write(fd, buf, nbytes));
+}
+static int memfs_access(const char *path, int mode) {
+    return(memfs->access(path, mode));
+}
+static int memfs_unlink(const char *path) { return(memfs->unlink(path)); }
+static int memfs_mkdir(const char *path, mode_t mode) {
+    return(memfs->mkdir(path, mode));
+}
+static int memfs_fallocate(int fd, off_t offset, off_t len) {
+    return(memfs->fallocate(fd, offset, len));
+}
+static int memfs_stat(const char *path, struct stat *st) {
+    return(memfs->stat(path, st));
+}
+static int memfs_chmod(const char *path, mode_t mode) {
+    return(memfs->chmod(path, mode));
+}
+
+static struct backend_driver memfs_backend_driver = {
+    memfs_open, memfs_close, memfs_write, memfs_access, memfs_unlink,
+    memfs_mkdir, memfs_fallocate, memfs_stat, memfs_chmod,
+};
+
 #ifdef DELTAFS     /* optional backend for cmu's deltafs */
 extern struct backend_driver deltafs_backend_driver;
 #endif
@@ -65,6 +104,12 @@ extern struct backend_driver deltafs_backend_driver;
 /* g_backend is the backend we are using (default=posix) */
 static struct backend_driver *g_backend = &posix_backend_driver;
 
+#ifdef HAVE_IO_URING
+/* io_uring path for posix, replaces the I/O workers when -b io_uring */
+static UringExecutor *uring = NULL;
+#define URING_DEPTH 256  /* max creates / deletes kept in flight */
+#endif
+
 /*
  * mkdir_path(path,mode): make an entire path(ala "mkdir -p").
  * ret 0 on sucess, -1 on error (errno set by mkdir).
@@ -117,15 +162,21 @@ static int mkdir_path(const char *path, mode_t mode) {
 }
 
 void issueCreate(const char *path, size_t len) {
-  int fd, rv = 1;
+  int fd, rv = 0;
+  auto t0 = nowNs();
   fd = g_backend->bd_open(path, O_RDWR|O_CREAT, 0600);
+  auto t1 = nowNs();
+  op_stats.latency[OpStats::OPEN].record(t1 - t0);
   assert(fd > -1);
   if(len > 0) {
     do {
-      if(rv < 0) {
+      if(rv != 0) { // posix_fallocate returns the error number
         sleep(1);
       }
+      t0 = nowNs();
       rv = g_backend->bd_fallocate(fd, 0, len);
+      t1 = nowNs();
+      op_stats.latency[OpStats::FALLOCATE].record(t1 - t0);
     } while(rv != 0);
     if(rv != 0) {
       fprintf(stderr,
@@ -134,46 +185,168 @@ void issueCreate(const char *path, size_t len) {
       abort();
     }
   }
+  if(change_map && (change_map->addFile(fd) < 0)) {
+    int none = 0;
+    track_errno.compare_exchange_strong(none, errno);
+  }
+  t0 = nowNs();
   rv = g_backend->bd_close(fd);
+  t1 = nowNs();
+  op_stats.latency[OpStats::CLOSE].record(t1 - t0);
   assert(rv == 0);
+  op_stats.opDone(len);
   return;
 }
 
-void issueAccess(const char *path) {
-  int retval = 0;
-  do {
-    retval = g_backend->bd_access(path, F_OK);
-    if(retval == -1) {
-      if(errno == EACCES || errno == ENOENT) {
-        continue;
-      } else {
-        assert(0);
-      }
-    }
-    return;
-  } while(1);
-}
-
+/*
+ * no need to wait for the file to show up first: the IoExecutor runs all
+ * ops on a path on one worker in order (and the io_uring path chains the
+ * unlink after the create's close), so the create has already completed.
+ */
 void issueDelete(const char *path) {
   int rv;
-  issueAccess(path);
+  if(change_map) {
+    // the blocks are about to be freed, note where they are
+    int fd = open(path, O_RDONLY);
+    if((fd < 0) ? (errno != ENOENT) : (change_map->addFile(fd) < 0)) {
+      int none = 0;
+      track_errno.compare_exchange_strong(none, errno);
+    }
+    if(fd >= 0) {
+      close(fd);
+    }
+  }
+  auto t0 = nowNs();
   rv = g_backend->bd_unlink(path);
+  op_stats.latency[OpStats::UNLINK].record(nowNs() - t0);
+  if((rv < 0) && (errno == ENOENT) && resumed) {
+    rv = 0; // already gone: replaying ops done after the checkpoint
+  }
   assert(rv == 0);
+  op_stats.opDone(0);
   return;
 }
 
+AgeList *global_file_list;
+FileTable file_table; // every File record, indexed by file id
+FileCell *file_cells; // NUM_AGES x NUM_SIZES x NUM_DIRS, age major
+BucketRank<AgeBucket> age_buckets;
+uint64_t age_cutoff_tick = 0; // tick the age bucket cutoffs were set for
+BucketRank<SizeBucket> size_buckets;
+BucketRank<DirBucket> dir_buckets;
+
+size_t File::getSize() const {
+  return size_buckets.buckets[size_id].size;
+}
+
+int File::getDepth() const {
+  return dir_buckets.buckets[dir_id].depth;
+}
+
+/**
+ * Build the full path of a file from its dir bucket, sibling dir and age.
+ */
+static int buildPath(char *buf, size_t len, uint16_t dir_id, uint32_t subdir,
+    uint64_t age) {
+  auto &d = dir_buckets.buckets[dir_id];
+  char sibling_dir[16] = "";
+  if(subdir > 0) {
+    snprintf(sibling_dir, sizeof(sibling_dir), "d%" PRIu32 "/", subdir);
+  }
+  return snprintf(buf, len, "%s%s%s/%s%" PRIu64, mount_point.c_str(),
+      (d.depth > 1) ? "/" : "", d.prefix.c_str(), sibling_dir, age);
+}
+
+/**
+ * The dir files of a dir bucket / sibling dir go in, relative to the
+ * mount point without leading or trailing slashes ("" for the root).
+ */
+static std::string fileDir(uint16_t dir_id, uint32_t subdir) {
+  char buf[PATH_MAX];
+  // the path of a file named "0" there, minus mount point and name
+  buildPath(buf, sizeof(buf), dir_id, subdir, 0);
+  std::string rel(buf + mount_point.size());
+  rel.pop_back();
+  while(!rel.empty() && (rel.back() == '/')) {
+    rel.pop_back();
+  }
+  while(!rel.empty() && (rel[0] == '/')) {
+    rel.erase(0, 1);
+  }
+  // collapse the "//" a depth 1 prefix can produce
+  for(auto pos = rel.find("//"); pos != std::string::npos;
+      pos = rel.find("//")) {
+    rel.erase(pos, 1);
+  }
+  return rel;
+}
+
+int File::getPath(char *buf, size_t len) const {
+  return buildPath(buf, len, dir_id, subdir, age);
+}
+
+/**
+ * Perform one op on an I/O worker.
+ */
+static void runOp(const IoOp &op) {
+  char path[PATH_MAX];
+  buildPath(path, sizeof(path), op.dir_id, op.subdir, op.age);
+  if(op.type == IoOp::CREATE) {
+    issueCreate(path, op.len);
+  } else {
+    issueDelete(path);
+  }
+}
+
+/* ops queued or in flight, sampled by the timeline thread */
+static size_t ioInflight() {
+#ifdef HAVE_IO_URING
+  if(uring) {
+    return uring->inflight();
+  }
+#endif
+  return io->inflight();
+}
+
+static IoOp makeOp(const File &f, IoOp::type_t type, uint64_t len) {
+  IoOp op;
+  op.age = f.age;
+  op.len = len;
+  op.subdir = f.subdir;
+  op.dir_id = f.dir_id;
+  op.type = type;
+  return op;
+}
+
+/* a dir in the op trace: a dir bucket and one of its sibling dirs */
+static uint64_t traceDirKey(uint16_t dir_id, uint32_t subdir) {
+  return ((uint64_t) dir_id << 32) | subdir;
+}
+
+static std::string traceDirName(uint64_t key) {
+  return fileDir(key >> 32, (uint32_t) key);
+}
+
 /**
  * Create a file.
  */
 int File::createFile() {
-  std::string slash = "";
-  if(depth > 1) {
-    slash = "/";
-  }
-  std::string path = mount_point + slash + this->path;
-  size_t size = this->blk_size * this->blk_count;
-  if(!fake)
-    pool->enqueue([path, size] { issueCreate(path.c_str(), size); });
+  if(record_file) {
+    trace.create(tick, age, traceDirKey(dir_id, subdir),
+        allocSize(getSize()));
+  }
+  if(!fake) {
+    size_t size = allocSize(getSize());
+#ifdef HAVE_IO_URING
+    if(uring) {
+      char buf[PATH_MAX];
+      getPath(buf, sizeof(buf));
+      uring->create(buf, size);
+      return 0;
+    }
+#endif
+    io->submit(makeOp(*this, IoOp::CREATE, size));
+  }
   return 0;
 }
 
@@ -181,12 +354,9 @@ int File::createFile() {
  * Access file
  */
 int File::accessFile() {
-  std::string slash = "";
-  if(depth != 0) {
-    slash = "/";
-  }
-  std::string full_path = mount_point + slash + this->path;
-  int retval = g_backend->bd_access(full_path.c_str(), F_OK);
+  char full_path[PATH_MAX];
+  getPath(full_path, sizeof(full_path));
+  int retval = g_backend->bd_access(full_path, F_OK);
   if(retval == -1) {
     if(errno == EACCES || errno == ENOENT) {
       return -1;
@@ -201,58 +371,22 @@ int File::accessFile() {
  * Delete a file.
  */
 int File::deleteFile() {
-  std::string slash = "";
-  if(depth != 0) {
-    slash = "/";
+  if(record_file) {
+    trace.remove(tick, age, traceDirKey(dir_id, subdir));
   }
-  std::string full_path = mount_point + slash + this->path;
-  if(!fake)
-    pool->enqueue([full_path] { issueDelete(full_path.c_str()); });
-  return 0;
-}
-
-struct BucketCompare {
-  bool operator()(const std::string& lhs, const std::string& rhs) const {
-    double v1 = 0, v2 = 0;
-    long l_id = -1, r_id = -1;
-    int i = 0;
-    boost::char_separator<char> sep(" ");
-    boost::tokenizer<boost::char_separator<char>> tok_l(lhs, sep);
-    for (auto it = tok_l.begin(); it != tok_l.end(); ++it) {
-      if(i == 0) {
-        l_id = std::stol(*it);
-        i++;
-        continue;
-      }
-      v1 = std::stod(*it);
-      break;
-    }
-    boost::tokenizer<boost::char_separator<char>> tok_r(rhs, sep);
-    i = 0;
-    for (auto it = tok_r.begin(); it != tok_r.end(); ++it) {
-      if(i == 0) {
-        r_id = std::stol(*it);
-        i++;
-        continue;
-      }
-      v2 = std::stod(*it);
-      break;
-    }
-    if(v1 < v2) {
-      return true;
-    } else if ((v1 == v2) && (l_id < r_id)) {
-      return true;
-    } else if ((v1 == v2) && (l_id > r_id)) {
-      return false;
+  if(!fake) {
+#ifdef HAVE_IO_URING
+    if(uring) {
+      char buf[PATH_MAX];
+      getPath(buf, sizeof(buf));
+      uring->unlink(buf);
+      return 0;
     }
-    return false;
+#endif
+    io->submit(makeOp(*this, IoOp::DELETE, 0));
   }
-};
-
-AgeList *global_file_list;
-flat_map<std::string, AgeBucket, BucketCompare> age_buckets;
-flat_map<std::string, SizeBucket, BucketCompare> *size_buckets;
-flat_map<std::string, DirBucket, BucketCompare> *dir_buckets;
+  return 0;
+}
 
 void readDistribution(void *input, distribution_type_t type) {
   int count = 0;
@@ -310,11 +444,22 @@ void readDistribution(void *input, distribution_type_t type) {
 }
 
 void init(struct age *a_grp, struct size *s_grp, struct dir *d_grp) {
-  int i, j, k;
+  int i;
   readDistribution(a_grp, AGES);
   readDistribution(s_grp, SIZES);
   readDistribution(d_grp, DIRS);
-  global_file_list = new AgeList(0);
+  // a File keeps its size and dir bucket ids in 16 bits
+  if(NUM_SIZES > UINT16_MAX) {
+    fprintf(stderr, "error: %s has %d size buckets, at most %d are "
+        "supported\n", s_grp->in_file, NUM_SIZES, UINT16_MAX);
+    exit(1);
+  }
+  if(NUM_DIRS > UINT16_MAX) {
+    fprintf(stderr, "error: %s has %d dir buckets, at most %d are "
+        "supported\n", d_grp->in_file, NUM_DIRS, UINT16_MAX);
+    exit(1);
+  }
+  global_file_list = new AgeList(&file_table, 0);
 
   for(i=0; i<NUM_AGES; i++) {
     total_age_weight += a_grp->distribution[i];
@@ -328,256 +473,414 @@ void init(struct age *a_grp, struct size *s_grp, struct dir *d_grp) {
     total_dir_weight += d_grp->distribution[i];
   }
 
-  size_buckets = new flat_map<std::string, SizeBucket, BucketCompare>;
   for(i=0; i<NUM_SIZES; i++) {
     SizeBucket s(s_grp->arr[i], i, s_grp->arr);
-    s.db = new unordered_map<int, DirBucket>();
-    for(j=0; j<NUM_DIRS; j++) {
-      DirBucket d(d_grp->arr[j], d_grp->subdir_arr[j], j,
-                  mount_point, fake, d_grp->arr, mkdir_path);
-      s.db->insert(std::pair<int, DirBucket>(d_grp->arr[j], d));
-    }
     s.ideal_fraction = s_grp->distribution[i] / total_size_weight;
-    s_grp->bucket_keys[i] = s.getKey();
-    size_buckets->insert(std::pair<std::string,
-        SizeBucket>(s_grp->bucket_keys[i], s));
+    size_buckets.add(s);
   }
 
+  file_cells = new FileCell[NUM_AGES * NUM_SIZES * NUM_DIRS];
   for(i=0; i<NUM_AGES; i++) {
     AgeBucket b(i);
-    b.sb = new unordered_map<size_t, SizeBucket>();
-    b.f = NULL;
-    for(j=0; j<NUM_SIZES; j++) {
-      SizeBucket s(s_grp->arr[j], j, s_grp->arr);
-      s.db = new unordered_map<int, DirBucket>();
-      for(k=0; k<NUM_DIRS; k++) {
-        DirBucket d(d_grp->arr[k], d_grp->subdir_arr[k], k, mount_point,
-                    fake, d_grp->arr, mkdir_path);
-        s.db->insert(std::pair<int, DirBucket>(d_grp->arr[k], d));
-      }
-      b.sb->insert(std::pair<size_t, SizeBucket>(s_grp->arr[j], s));
-    }
+    b.cells = file_cells + (i * NUM_SIZES * NUM_DIRS);
+    b.num_dirs = NUM_DIRS;
+    b.ft = &file_table;
     b.ideal_fraction = a_grp->distribution[i] / total_age_weight;
     if(i == 0) {
       b.youngest_bucket = true;
     }
     b.ratio = 1 - (a_grp->cutoffs[i] / a_grp->cutoffs[NUM_AGES-1]);
-    a_grp->bucket_keys[i] = b.getKey();
-    age_buckets.insert(std::pair<std::string,
-        AgeBucket>(a_grp->bucket_keys[i], b));
+    age_buckets.add(b);
   }
 
-  dir_buckets = new flat_map<std::string, DirBucket, BucketCompare>;
+  int live_depth = 0;
   for(i=0; i<NUM_DIRS; i++) {
-    DirBucket d(d_grp->arr[i], d_grp->subdir_arr[i], i, mount_point,
-                fake, d_grp->arr, mkdir_path);
+    DirBucket d(d_grp->arr[i], d_grp->subdir_arr[i], i, d_grp->arr,
+                live_depth < d_grp->arr[i]);
     d.ideal_fraction = d_grp->distribution[i] / total_dir_weight;
-    d_grp->bucket_keys[i] = d.getKey();
-    dir_buckets->insert(std::pair<std::string,
-        DirBucket>(d_grp->bucket_keys[i], d));
+    dir_buckets.add(d);
+    if(d.depth > 0) {
+      live_depth = d.depth;
+    }
+  }
+}
+
+/*
+ * the dirs files can be created in and their parents, relative to the
+ * mount point, by level (depth - 1), each with its op trace key
+ * (TraceWriter::NO_KEY for a parent no file goes in)
+ */
+static std::vector<std::vector<std::pair<std::string, uint64_t> > >
+dirLevels() {
+  std::map<std::string, uint64_t> unique;
+  for(auto &db : dir_buckets.buckets) {
+    uint32_t subdirs = ((db.depth > 0) && (db.sibling_dirs > 0)) ?
+      db.sibling_dirs : 0;
+    for(uint32_t j = (subdirs > 0) ? 1 : 0; j <= subdirs; j++) {
+      auto rel = fileDir(db.id, j);
+      for(size_t pos = rel.find('/'); pos != std::string::npos;
+          pos = rel.find('/', pos + 1)) {
+        unique.insert(std::make_pair(rel.substr(0, pos),
+              TraceWriter::NO_KEY));
+      }
+      if(!rel.empty()) {
+        auto &key = unique.insert(std::make_pair(rel,
+              TraceWriter::NO_KEY)).first->second;
+        if(key == TraceWriter::NO_KEY) {
+          key = traceDirKey(db.id, j);
+        }
+      }
+    }
+  }
+
+  std::vector<std::vector<std::pair<std::string, uint64_t> > > levels;
+  for(auto &e : unique) {
+    size_t level = std::count(e.first.begin(), e.first.end(), '/');
+    if(levels.size() <= level) {
+      levels.resize(level + 1);
+    }
+    levels[level].push_back(e);
+  }
+  return levels;
+}
+
+/*
+ * Directory layout phase: make the dirs files can be created in (and
+ * their parents) a level at a time, every level in parallel on the given
+ * number of threads.
+ */
+int makeDirs(int threads) {
+  std::vector<std::vector<std::string> > levels;
+  for(auto &level : dirLevels()) {
+    levels.emplace_back();
+    for(auto &e : level) {
+      levels.back().push_back(mount_point + "/" + e.first);
+    }
+  }
+
+  if(mkdir_path(mount_point.c_str(), 0777) < 0) {
+    fprintf(stderr, "error: mkdir %s: %s\n", mount_point.c_str(),
+        strerror(errno));
+    return -1;
+  }
+  std::atomic<int> failed(0);
+  for(auto &level : levels) {
+    std::vector<std::thread> workers;
+    for(int t=0; t<std::max(threads, 1); t++) {
+      workers.emplace_back([&level, &failed, t, threads] {
+        for(size_t k=t; k<level.size(); k+=std::max(threads, 1)) {
+          auto &path = level[k];
+          if((g_backend->bd_mkdir(path.c_str(), 0777) < 0) &&
+              (errno != EEXIST)) {
+            fprintf(stderr, "error: mkdir %s: %s\n", path.c_str(),
+                strerror(errno));
+            failed = 1;
+          }
+        }
+      });
+    }
+    for(auto &w : workers) {
+      w.join();
+    }
+    if(failed) {
+      return -1;
+    }
   }
+  return 0;
 }
 
 void destroy() {
-  delete dist;
-  delete pool;
+  delete io; // runs every op still queued
+#ifdef HAVE_IO_URING
+  delete uring; // waits for everything still in flight
+  uring = NULL;
+#endif
+  delete memfs;
+  memfs = NULL;
+
+  // release the whole aging model
   delete global_file_list;
+  file_table.clear();
+  delete [] file_cells;
+  age_buckets.clear();
+  size_buckets.clear();
+  dir_buckets.clear();
+  free(a.distribution);
+  free(a.cutoffs);
+  free(s.arr);
+  free(s.cutoffs);
+  free(s.distribution);
+  free(d.arr);
+  free(d.distribution);
+  free(d.subdir_arr);
   //ProfilerStop();
 }
 
-void dumpSizeBuckets(char *f = NULL) {
-  FILE *fp = NULL;
-  if(f) {
-    fp = fopen(f, "w");
-    fprintf(fp, "SIZE FRACTION TYPE\n");
-  }
+/*
+ * a distribution dump is a header and an IDEAL and an ACTUAL row per
+ * bucket; the rows are copied off the model so the stats writer can
+ * print them while aging goes on
+ */
+struct FractionRow {
+  uint64_t label; // bucket id, size or depth
+  double ideal;
+  double actual;
+};
 
+static void submitFractions(char *f, const char *header,
+    const std::vector<FractionRow> &rows) {
+  stats_writer.submit(f, [header, rows](FILE *fp) {
+    fprintf(fp, "%s\n", header);
+    for(auto &r : rows) {
+      fprintf(fp, "%" PRIu64 " %f IDEAL\n", r.label, r.ideal);
+      fprintf(fp, "%" PRIu64 " %f ACTUAL\n", r.label, r.actual);
+    }
+  });
+}
+
+void dumpSizeBuckets(char *f = NULL) {
   if(f) {
-    auto current_id = 0;
-    while(current_id < NUM_SIZES) {
-      auto it = size_buckets->rbegin();
-      auto s = it->second;
-      while(s.id != current_id) {
-        it++;
-        s = it->second;
-      }
-      fprintf(fp, "%" PRIu64 " %f IDEAL\n", s.size, s.ideal_fraction);
-      fprintf(fp, "%" PRIu64 " %f ACTUAL\n", s.size, s.actual_fraction);
-      current_id++;
+    std::vector<FractionRow> rows(NUM_SIZES);
+    for(auto current_id = 0; current_id < NUM_SIZES; current_id++) {
+      auto &sb = size_buckets[current_id];
+      rows[current_id] = {sb.size, sb.ideal_fraction, sb.actual_fraction};
     }
-    fclose(fp);
+    submitFractions(f, "SIZE FRACTION TYPE", rows);
   }
 }
 
 void dumpDirBuckets(char *f = NULL) {
-  FILE *fp = NULL;
   if(f) {
-    fp = fopen(f, "w");
-    fprintf(fp, "DEPTH FRACTION TYPE\n");
+    std::vector<FractionRow> rows(NUM_DIRS);
+    for(auto current_id = 0; current_id < NUM_DIRS; current_id++) {
+      auto &db = dir_buckets[current_id];
+      rows[current_id] = {(uint64_t) db.depth, db.ideal_fraction,
+        db.actual_fraction};
+    }
+    submitFractions(f, "DEPTH FRACTION TYPE", rows);
   }
+}
 
-  if(f) {
-    auto current_id = 0;
-    while(current_id < NUM_DIRS) {
-      auto it = dir_buckets->rbegin();
-      auto d = it->second;
-      while(d.id != current_id) {
-        it++;
-        d = it->second;
+/*
+ * fragmentation of a memfs: free runs by size (BUCKET is the smallest run
+ * length of a power of two class), files by number of extents (the last
+ * BUCKET also counts files with more) and the layout score
+ */
+void dumpFragmentation(char *f = NULL) {
+  if(!f || !memfs) {
+    return;
+  }
+  auto u = memfs->usage();
+  stats_writer.submit(f, [u](FILE *fp) {
+    fprintf(fp, "BUCKET VALUE TYPE\n");
+    for(auto c = 0; c < BlockAllocator::CLASSES; c++) {
+      if(u.free_hist[c] > 0) {
+        fprintf(fp, "%" PRIu64 " %" PRIu64 " FREE\n", (uint64_t) 1 << c,
+            u.free_hist[c]);
       }
-      fprintf(fp, "%d %f IDEAL\n", d.depth, d.ideal_fraction);
-      fprintf(fp, "%d %f ACTUAL\n", d.depth, d.actual_fraction);
-      current_id++;
     }
-    fclose(fp);
-  }
-}
-
-double calculateChiMeanSquared(std::list<double> expected,
-    std::list<double> actual, char *age_dump_file,
-    char *size_dump_file, char *dir_dump_file) {
-  double chi_2 = 0.0;
-  for(auto e_it = expected.begin(), a_it = actual.begin();
-      e_it != expected.end(); e_it++, a_it++) {
-    chi_2 += pow(double((*e_it - *a_it)), 2) / *e_it;
-  }
-
-  auto goodness_of_my_dist = cdf(*dist, chi_2);
-  if(goodness_of_my_dist <= goodness_measure) {
-    dumpSizeBuckets(size_dump_file);
-    dumpDirBuckets(dir_dump_file);
-    auto current_id = 0;
-    auto fp = fopen(age_dump_file, "w");
-    fprintf(fp, "BUCKET FRACTION TYPE\n");
-    while(current_id < NUM_AGES) {
-      auto it = age_buckets.rbegin();
-      auto a = it->second;
-      while(a.id != current_id) {
-        it++;
-        a = it->second;
+    for(auto n = 1; n <= MemFs::MAX_EXTENTS; n++) {
+      if(u.extent_hist[n] > 0) {
+        fprintf(fp, "%d %" PRIu64 " EXTENTS\n", n, u.extent_hist[n]);
       }
-      fprintf(fp, "%d %f IDEAL\n", a.id, a.ideal_fraction);
-      fprintf(fp, "%d %f ACTUAL\n", a.id, a.actual_fraction);
-      current_id++;
     }
-    return goodness_of_my_dist;
-  }
-  return 0;
+    fprintf(fp, "0 %f LAYOUT\n", u.layout_score);
+  });
 }
 
-
-int dumpAgeBuckets(char *age_dump_file = NULL, char *size_dump_file = NULL,
-    char *dir_dump_file = NULL, int only_calculate_accuracy = 0) {
-  FILE *fp = NULL;
+/*
+ * the age buckets to age_dump_file in id order, or to stdout oldest
+ * bucket first with their files' ages
+ */
+void dumpAgeBuckets(char *age_dump_file = NULL) {
   if(age_dump_file) {
-    fp = fopen(age_dump_file, "w");
-    fprintf(fp, "BUCKET FRACTION TYPE\n");
+    std::vector<FractionRow> rows(NUM_AGES);
+    for(auto current_id = 0; current_id < NUM_AGES; current_id++) {
+      auto &ab = age_buckets[current_id];
+      rows[current_id] = {(uint64_t) ab.id, ab.ideal_fraction,
+        ab.actual_fraction};
+    }
+    submitFractions(age_dump_file, "BUCKET FRACTION TYPE", rows);
+    return;
   }
 
-  std::list <double> expected;
-  std::list <double> actual;
+  std::cout << std::endl << 
+    "************ AGE BUCKET DUMP *************" << std::endl;
+  auto r = age_buckets.size();
+  uint64_t oldest = 0; uint64_t youngest = 0;
+  while(r > 0) {
+    r--;
+    oldest = 0;
+    youngest = 0;
+    auto &a = age_buckets.at(r);
+    if(a.f != 0) {
+      oldest = file_table[a.f].age;
+    }
 
-  if(age_dump_file) {
-    auto current_id = 0;
-    while(current_id < NUM_AGES) {
-      auto it = age_buckets.rbegin();
-      auto a = it->second;
-      while(a.id != current_id) {
-        it++;
-        a = it->second;
-      }
-      fprintf(fp, "%d %f IDEAL\n", a.id, a.ideal_fraction);
-      fprintf(fp, "%d %f ACTUAL\n", a.id, a.actual_fraction);
-      expected.push_back(a.ideal_fraction);
-      actual.push_back(a.actual_fraction);
-      current_id++;
+    if(a.last != 0) {
+      youngest = file_table[a.last].age;
     }
-    fclose(fp);
-  } else {
-    if(!only_calculate_accuracy) {
-      std::cout << std::endl << 
-        "************ AGE BUCKET DUMP *************" << std::endl;
+    std::cout << "Bucket = " << a.id << ", Ideal Ratio = " <<
+      a.ideal_fraction << ", Actual Ratio = " << a.actual_fraction <<
+      ", Count = " << a.count << ", Cutoff = " << a.cutoff <<
+      ", Oldest file = " << oldest << ", Youngest file = "
+      << youngest << std::endl;
+  }
+}
+
+/*
+ * the distributions aging can be stopped on, with the chi-squared distance
+ * of their fractions from the ideal ones to reach (-c, --size-confidence,
+ * --dir-confidence), 0 if they don't count
+ */
+struct FitTarget {
+  const char *name;
+  double *target;
+  FitTracker *fit;
+};
+static FitTarget fit_targets[] = {
+  {"Age", &confidence, &age_buckets.fit},
+  {"Size", &size_confidence, &size_buckets.fit},
+  {"Dir depth", &dir_confidence, &dir_buckets.fit},
+};
+
+bool accuracyRequested() {
+  for(auto &t : fit_targets) {
+    if(*t.target > 0) {
+      return true;
     }
-    auto it = age_buckets.rbegin();
-    uint64_t oldest = 0; uint64_t youngest = 0;
-    while(it != age_buckets.rend()) {
-      oldest = 0;
-      youngest = 0;
-      auto a = it->second;
-      if(a.f != NULL) {
-        oldest = a.f->age;
-      }
+  }
+  return false;
+}
 
-      if(a.last != NULL) {
-        youngest = a.last->age;
-      }
-      expected.push_back(a.ideal_fraction);
-      actual.push_back(a.actual_fraction);
-
-      if(!only_calculate_accuracy) {
-        std::cout << "Bucket = " << a.id << ", Ideal Ratio = " <<
-          a.ideal_fraction << ", Actual Ratio = " << a.actual_fraction <<
-          ", Count = " << a.count << ", Cutoff = " << a.cutoff <<
-          ", Oldest file = " << oldest << ", Youngest file = "
-          << youngest << std::endl;
+/* every distribution with a target is within it, O(1) */
+bool accuracyMet() {
+  bool requested = false;
+  for(auto &t : fit_targets) {
+    if(*t.target > 0) {
+      if(t.fit->chiSquared() > *t.target) {
+        return false;
       }
-      it++;
+      requested = true;
     }
   }
+  return requested;
+}
 
-  if(confidence > 0.0) {
-    return calculateChiMeanSquared(expected, actual, age_dump_file,
-        size_dump_file, dir_dump_file);
+/* " <name> chi-squared measure = x, target = t" for each one with a target */
+void printAccuracy() {
+  for(auto &t : fit_targets) {
+    if(*t.target > 0) {
+      std::cout << " " << t.name << " chi-squared measure = " <<
+        t.fit->chiSquared() << ", target = " << *t.target << std::endl;
+    }
   }
-  return 0;
+}
+
+/* all rand() draws go through here so a checkpoint can replay them */
+int nextRand() {
+  rand_calls++;
+  return rand();
 }
 
 float tossCoin() {
-  return ((float) (rand() % 100)) / 100;
+  return ((float) (nextRand() % 100)) / 100;
 }
 
+/*
+ * Migrate files whose age fell below their bucket's cutoff to the next
+ * older bucket.  After a pass every bucket's oldest file is at or above
+ * its cutoff, and between passes only a create into an empty youngest
+ * bucket can break that (deletes only make a bucket's oldest file
+ * younger).  So unless the cutoffs moved, we start at the youngest
+ * bucket and stop at the first one that did not gain a new oldest file,
+ * which makes a tick without boundary crossings O(1).
+ */
 void reAge(struct age *a_grp, uint64_t future_tick = 0) {
   int i = 0;
-  AgeBucket a, *ab = new AgeBucket[NUM_AGES];
-  unordered_map<int, AgeBucket> age_bucket_map;
+  bool full_pass = false;
+  auto cutoff_tick = (future_tick == 0) ? tick : future_tick;
 
-  for(i=0; i<NUM_AGES; i++) {
-    ab[i] = (age_buckets.find(a_grp->bucket_keys[i]))->second;
+  if(cutoff_tick != age_cutoff_tick) {
     // revise cutoffs
-    if(future_tick == 0) {
-      ab[i].cutoff = ab[i].ratio * tick;
-    } else {
-      ab[i].cutoff = ab[i].ratio * future_tick;
+    for(i=0; i<NUM_AGES; i++) {
+      age_buckets[i].cutoff = age_buckets[i].ratio * cutoff_tick;
     }
+    age_cutoff_tick = cutoff_tick;
+    full_pass = true;
   }
 
   /*
    * Note that the loop below goes to n-1 age buckets.
    */
   for(i=0; i<NUM_AGES-1; i++) {
-    if(ab[i].last == NULL) {
-      continue;
-    }
-
-    while(ab[i].count > 0) {
-      auto f = ab[i].f;
-      if(f->age >= ab[i].cutoff) {
+    auto &ab = age_buckets[i];
+    auto &older = age_buckets[i+1];
+    bool older_was_empty = (older.count == 0);
+    bool migrated = false;
+
+    while(ab.count > 0) {
+      auto f = ab.f;
+      if(file_table[f].age >= ab.cutoff) {
         break;
       }
 
-      ab[i].deleteFile(f, global_live_file_count);
-      ab[i+1].addFile(f, global_live_file_count, false);
+      ab.deleteFile(f, global_live_file_count);
+      older.addFile(f, global_live_file_count, false);
+      migrated = true;
     }
-  }
 
-  for(i=0; i<NUM_AGES; i++) {
-    auto old_key = ab[i].replace(a_grp->bucket_keys);
-    age_buckets.erase(old_key);
-    age_buckets.insert(std::pair<std::string, AgeBucket>(a_grp->bucket_keys[i],
-          ab[i]));
+    if(migrated) {
+      age_buckets.update(i);
+      age_buckets.update(i+1);
+    }
+    if(!full_pass && !(migrated && older_was_empty)) {
+      break;
+    }
   }
+}
 
-  delete [] ab;
+/* what the I/O path and the backend did, for dumpStats() and --replay */
+static void dumpIoStats() {
+  // planner stalled a lot -> device bound, window mostly empty -> cpu bound
+  const IoWindowStats *ws = &io->windowStats();
+  size_t window = io->windowSize();
+#ifdef HAVE_IO_URING
+  if(uring) {
+    ws = &uring->windowStats();
+    window = uring->windowSize();
+  }
+#endif
+  std::cout << " I/O window = " << window << " ops, mean in flight = " <<
+    ws->meanDepth() << ", planner stalled " <<
+    ws->stallFraction() * 100 << "% of the time" << std::endl;
+  op_stats.print(std::cout);
+  if(memfs) {
+    auto u = memfs->usage();
+    std::cout << " memfs: " << u.files << " files in " << u.dirs <<
+      " dirs, " << (u.blocks - u.free_blocks) * MemFs::BLOCK / 1048576 <<
+      " MB used in " << u.file_extents << " extents, " <<
+      u.free_blocks * MemFs::BLOCK / 1048576 << " MB free in " <<
+      u.free_extents << " extents";
+    if(u.blocks > u.device_blocks) {
+      std::cout << ", device grown " << u.grown << " times by " <<
+        (u.blocks - u.device_blocks) * MemFs::BLOCK / 1024 << " KB";
+    }
+    std::cout << std::endl;
+    std::cout << " memfs layout score = " << u.layout_score << std::endl;
+    if(frag_out_file) {
+      std::cout << " Fragmentation dumped in " << frag_out_file << std::endl;
+    }
+  }
+  if(stats_prefix) {
+    auto path = std::string(stats_prefix) + ".latency.csv";
+    if(op_stats.dump(path.c_str()) < 0) {
+      fprintf(stderr, "warning: writing %s failed: %s\n", path.c_str(),
+          strerror(errno));
+    } else {
+      std::cout << " Latency histograms dumped in " << path << std::endl;
+    }
+  }
 }
 
 void dumpStats(struct age *a, struct size *s, struct dir *d) {
@@ -587,18 +890,44 @@ void dumpStats(struct age *a, struct size *s, struct dir *d) {
   std::cout << " Number of disk overwrites = " << runs << std::endl;
   std::cout << " Total aging workload created = " <<
     workload_size / 1048576 << " MB" << std::endl;
-  if (confidence > 0) {
-    std::cout << " Confidence achieved (chi-squared measure) = " <<
-      confidence << std::endl;
+  std::cout << " Live files = " << file_table.live << ", peak = " <<
+    file_table.high_water << " (file arena " <<
+    file_table.bytes() / 1048576 << " MB)" << std::endl;
+  if(!fake) {
+    dumpIoStats();
+  }
+  if(accuracyRequested()) {
+    printAccuracy();
   } else {
     std::cout << " Perfect convergence achieved" << std::endl;
   }
   std::cout << " Size distribution dumped in " << s->out_file << std::endl;
   std::cout << " Dir depth distribution dumped in " << d->out_file << std::endl;
   std::cout << " Age distribution dumped in " << a->out_file << std::endl;
+  if(record_file) {
+    std::cout << " Op trace of " << trace.recorded() << " operations " <<
+      "recorded in " << record_file << std::endl;
+  }
+  if(change_map && (track_errno.load() == 0)) {
+    std::cout << " Changed block map (" << change_map->changed.count() *
+      ChangeMap::BLOCK / 1048576 << " MB changed, " <<
+      change_map->base.count() * ChangeMap::BLOCK / 1048576 <<
+      " MB of base files) saved in " << track_file << std::endl;
+  }
   std::cout << "================================================" << std::endl;
 }
 
+/* sibling dir a new file in d goes to, 0 if d has none */
+static uint32_t pickSubdir(const DirBucket &d) {
+  if((d.depth > 0) && (d.sibling_dirs > 0)) {
+    LazyMt19937 gen(nextRand());
+    boost::random::uniform_int_distribution<std::uint64_t> dist{1,
+      static_cast<std::uint64_t>(d.sibling_dirs)};
+    return dist(gen);
+  }
+  return 0;
+}
+
 size_t createFile(int size_arr_position, struct age *a_grp, struct size *s_grp,
     struct dir *d_grp, int *create_succeeded) {
   /*
@@ -617,97 +946,60 @@ size_t createFile(int size_arr_position, struct age *a_grp, struct size *s_grp,
    */
 
   // step 1
-  SizeBucket sb(0, 0, s_grp->arr);
+  SizeBucket *sb = NULL;
   if(size_arr_position >= 0) {
-    auto it = size_buckets->find(s_grp->bucket_keys[size_arr_position]);
-    assert(it != size_buckets->end());
-    sb = it->second;
+    assert(size_arr_position < (int) size_buckets.size());
+    sb = &size_buckets[size_arr_position];
   } else {
     // the size bucket farthest away from its ideal fraction
-    auto it = size_buckets->rbegin();
-    while((it->second.size + live_data_size) >= total_disk_capacity) {
-      if (it == size_buckets->rend()) {
-        std::cout << "Cannot create a single file, exhausted all options!"
-          << std::endl;
-        *create_succeeded = -1;
-        return 0;
+    auto r = size_buckets.size();
+    while(r > 0) {
+      r--;
+      if((size_buckets.at(r).size + live_data_size) < total_disk_capacity) {
+        sb = &size_buckets.at(r);
+        break;
       }
-      it++;
     }
-    sb = it->second;
+    if(sb == NULL) {
+      std::cout << "Cannot create a single file, exhausted all options!"
+        << std::endl;
+      *create_succeeded = -1;
+      return 0;
+    }
   }
 
   // step 2
-  auto d_it = dir_buckets->begin();
-  auto d = d_it->second;
+  auto &d = dir_buckets.at(0);
 
   // step 3
-  char name[PATH_MAX];
-  std::string sibling_dir = "";
-  if((d.depth > 0) && (d.sibling_dirs > 0)) {
-    boost::random::mt19937 gen{static_cast<std::uint64_t>(rand())};
-    boost::random::uniform_int_distribution<std::uint64_t> dist{1,
-      static_cast<std::uint64_t>(d.sibling_dirs)};
-    auto rand_subdir = dist(gen);
-    sibling_dir += "d" + std::to_string(rand_subdir) + "/";
-  }
-  snprintf(name, PATH_MAX, "%s/%s%" PRIu64, d.prefix.c_str(),
-           sibling_dir.c_str(), tick);
-  File *f = new File(name, sb.size, tick, d.depth); // step 2
-  auto retval = f->createFile();
+  auto subdir = pickSubdir(d);
+  auto f = file_table.alloc();
+  file_table[f].age = tick;
+  file_table[f].size_id = sb->id;
+  file_table[f].dir_id = d.id;
+  file_table[f].subdir = subdir;
+  auto retval = file_table[f].createFile();
   assert(retval == 0);
-  auto ret_size = f->size;
+  auto ret_size = sb->size;
 
   // step 4
   global_live_file_count++;
 
   // step 5
-  dir_buckets->erase(d_grp->bucket_keys[d.id]);
   d.count++;
-  d.reKey(global_live_file_count, d_grp->bucket_keys);
-  dir_buckets->insert(std::pair<std::string,
-      DirBucket>(d_grp->bucket_keys[d.id], d));
-  auto old_dir_buckets = dir_buckets;
-  d_it = old_dir_buckets->begin();
-  dir_buckets = new flat_map<std::string, DirBucket, BucketCompare>;
-  while(d_it != old_dir_buckets->end()) {
-    d = d_it->second;
-    d.reKey(global_live_file_count, d_grp->bucket_keys);
-    dir_buckets->insert(std::pair<std::string,
-        DirBucket>(d_grp->bucket_keys[d.id], d));
-    d_it++;
-  }
-  delete old_dir_buckets;
+  dir_buckets.reRank(global_live_file_count);
 
   // step 6
   global_file_list->addFile(f);
 
   // step 7
-  size_buckets->erase(s_grp->bucket_keys[sb.id]);
-  sb.addFile(f, global_live_file_count);
-  s_grp->bucket_keys[sb.id] = sb.getKey();
-  size_buckets->insert(std::pair<std::string,
-      SizeBucket>(s_grp->bucket_keys[sb.id], sb));
-  auto old_size_buckets = size_buckets;
-  auto s_it = old_size_buckets->begin();
-  size_buckets = new flat_map<std::string, SizeBucket, BucketCompare>;
-  while(s_it != old_size_buckets->end()) {
-    auto s = s_it->second;
-    s.reKey(global_live_file_count, s_grp->bucket_keys);
-    size_buckets->insert(std::pair<std::string,
-        SizeBucket>(s_grp->bucket_keys[s.id], s));
-    s_it++;
-  }
-  delete old_size_buckets;
+  sb->addFile(global_live_file_count);
+  size_buckets.reRank(global_live_file_count);
 
   // step 8
   // youngest bucket
-  AgeBucket ab = ((age_buckets.find(a_grp->bucket_keys[0]))->second);
-  age_buckets.erase(a_grp->bucket_keys[ab.id]);
-  ab.addFile(f, global_live_file_count, false);
-  a_grp->bucket_keys[ab.id] = ab.getKey();
-  age_buckets.insert(std::pair<std::string,
-      AgeBucket>(a_grp->bucket_keys[ab.id], ab));
+  age_buckets[0].addFile(f, global_live_file_count, false);
+  age_buckets.update(0);
   return ret_size;
 }
 
@@ -729,94 +1021,62 @@ size_t deleteFile(struct age *a_grp, struct size *s_grp, struct dir *d_grp) {
    */
 
   // step 1
-  File *f = NULL;
-  SizeBucket sb(0, 0, s_grp->arr); // dummy SizeBucket
-  AgeBucket ab;
-  DirBucket db(0, 0, 0, mount_point, fake,
-               d_grp->arr, mkdir_path); // dummy DirBucket
+  uint32_t f = 0;
+  SizeBucket *sb = NULL;
+  AgeBucket *ab = NULL;
+  DirBucket *db = NULL;
 
-  auto a_it = age_buckets.rbegin();
+  auto a_pos = age_buckets.size();
 
   // select age bucket
   do {
-    ab = a_it->second;
-    auto s_it = size_buckets->begin();
+    a_pos--;
+    ab = &age_buckets.at(a_pos);
+    size_t s_pos = 0;
     // select size bucket
     do {
-      sb = s_it->second;
-      auto d_it = dir_buckets->rbegin();
+      sb = &size_buckets.at(s_pos);
+      auto d_pos = dir_buckets.size();
       // select dir bucket
       do {
-        db = d_it->second;
-        f = ab.getFileToDelete(sb.size, db.depth);
-        d_it++;
-      } while((f == NULL) && (d_it != dir_buckets->rend()));
-      s_it++;
-    } while((f == NULL) && (s_it != size_buckets->end()));
-    a_it++;
-  } while((f == NULL) && (a_it != age_buckets.rend()));
-
-  if(f == NULL) {
+        d_pos--;
+        db = &dir_buckets.at(d_pos);
+        f = ab->getFileToDelete(sb->id, db->id, victim_gen);
+      } while((f == 0) && (d_pos > 0));
+      s_pos++;
+    } while((f == 0) && (s_pos < size_buckets.size()));
+  } while((f == 0) && (a_pos > 0));
+
+  if(f == 0) {
     std::cout << "Cannot delete a single file of any size!" << std::endl;
     exit(1);
   }
 
-  auto ret_size = f->size;
+  auto ret_size = sb->size;
 
   // step 4
-  auto retval = f->deleteFile();
+  auto retval = file_table[f].deleteFile();
   assert(retval == 0);
 
   // step 5
   global_live_file_count--;
 
   // step 6
-  dir_buckets->erase(d_grp->bucket_keys[db.id]);
-  db.count--;
-  db.reKey(global_live_file_count, d_grp->bucket_keys);
-  dir_buckets->insert(std::pair<std::string,
-      DirBucket>(d_grp->bucket_keys[db.id], db));
-  auto old_dir_buckets = dir_buckets;
-  auto d_it = old_dir_buckets->begin();
-  dir_buckets = new flat_map<std::string, DirBucket, BucketCompare>;
-  while(d_it != old_dir_buckets->end()) {
-    auto d = d_it->second;
-    d.reKey(global_live_file_count, d_grp->bucket_keys);
-    dir_buckets->insert(std::pair<std::string,
-        DirBucket>(d_grp->bucket_keys[d.id], d));
-    d_it++;
-  }
-  delete old_dir_buckets;
+  db->count--;
+  dir_buckets.reRank(global_live_file_count);
 
   // step 7
-  age_buckets.erase(a_grp->bucket_keys[ab.id]);
-  ab.deleteFile(f, global_live_file_count);
-  a_grp->bucket_keys[ab.id] = ab.getKey();
-  age_buckets.insert(std::pair<std::string,
-      AgeBucket>(a_grp->bucket_keys[ab.id], ab));
+  ab->deleteFile(f, global_live_file_count);
+  age_buckets.update(ab->id);
 
   // step 8
-  size_buckets->erase(s_grp->bucket_keys[sb.id]);
-  sb.deleteFile(f, global_live_file_count);
-  s_grp->bucket_keys[sb.id] = sb.getKey();
-  size_buckets->insert(std::pair<std::string,
-      SizeBucket>(s_grp->bucket_keys[sb.id], sb));
-  auto old_size_buckets = size_buckets;
-  auto s_it = old_size_buckets->begin();
-  size_buckets = new flat_map<std::string, SizeBucket, BucketCompare>;
-  while(s_it != old_size_buckets->end()) {
-    auto s = s_it->second;
-    s.reKey(global_live_file_count, s_grp->bucket_keys);
-    size_buckets->insert(std::pair<std::string,
-        SizeBucket>(s_grp->bucket_keys[s.id], s));
-    s_it++;
-  }
-  delete old_size_buckets;
+  sb->deleteFile(global_live_file_count);
+  size_buckets.reRank(global_live_file_count);
 
   // step 9
   global_file_list->deleteFile(f);
 
-  delete f;
+  file_table.release(f);
   return ret_size;
 }
 
@@ -826,12 +1086,12 @@ uint64_t calculateT(struct age *a_grp) {
   int i = 0;
   auto s_i = 0.0;
   for(i=0; i < NUM_AGES - 1; i++) {
-    auto a = (age_buckets.find(a_grp->bucket_keys[i]))->second;
+    auto &a = age_buckets[i];
 
     if (i == 0) {
       s_i = 1 - a.ratio;
     } else {
-      auto younger_a = (age_buckets.find(a_grp->bucket_keys[i-1]))->second;
+      auto &younger_a = age_buckets[i-1];
       s_i = younger_a.ratio - a.ratio;
     }
     t = 2 * K * ((double)a.ideal_fraction / s_i);
@@ -840,8 +1100,8 @@ uint64_t calculateT(struct age *a_grp) {
     }
   }
 
-  auto a = (age_buckets.find(a_grp->bucket_keys[i]))->second;
-  auto younger_a = (age_buckets.find(a_grp->bucket_keys[i-1]))->second;
+  auto &a = age_buckets[i];
+  auto &younger_a = age_buckets[i-1];
   s_i = younger_a.ratio - a.ratio;
   t = ((double)(2 * K * (a.ideal_fraction - 1) + K) / s_i);
   if (t > 0 && T < t) {
@@ -854,6 +1114,404 @@ uint64_t calculateT(struct age *a_grp) {
   return T;
 }
 
+/*
+ * Checkpoints.  The complete aging model -- counters, bucket state and
+ * ranking, every File record and cell, and the random number generators
+ * -- is saved so that --resume carries on from the exact tick the
+ * checkpoint was taken at, making the same choices an uninterrupted run
+ * would have made.  rand() has no portable way to save its state, so the
+ * number of draws is saved and replayed from the seed instead.
+ */
+static std::string checkpointPath() {
+  return mount_point + ".geriatrix-ckpt";
+}
+
+template <class T>
+static void saveRank(CheckpointFile &cf, BucketRank<T> &r) {
+  cf.putVector(r.keys);
+  cf.putVector(r.rank);
+}
+
+template <class T>
+static void loadRank(CheckpointFile &cf, BucketRank<T> &r) {
+  cf.getVector(r.keys);
+  cf.getVector(r.rank);
+  if((r.keys.size() != r.size()) || (r.rank.size() != r.size())) {
+    cf.failed = true;
+  }
+  r.refit();
+}
+
+static void saveModel(CheckpointFile &cf) {
+  cf.put((uint64_t) CheckpointFile::MAGIC);
+  cf.put((int64_t) seed);
+  cf.put((uint64_t) total_disk_capacity);
+  cf.put((int32_t) NUM_AGES);
+  cf.put((int32_t) NUM_SIZES);
+  cf.put((int32_t) NUM_DIRS);
+
+  cf.put(tick);
+  cf.put(K);
+  cf.put(global_live_file_count);
+  cf.put((uint64_t) live_data_size);
+  cf.put((uint64_t) workload_size);
+  cf.put(age_cutoff_tick);
+  cf.put(rand_calls);
+  std::ostringstream gen;
+  gen << victim_gen;
+  cf.putString(gen.str());
+
+  for(auto &ab : age_buckets.buckets) {
+    cf.put(ab.f);
+    cf.put(ab.last);
+    cf.put(ab.count);
+    cf.put(ab.cutoff);
+    cf.put(ab.actual_fraction);
+  }
+  saveRank(cf, age_buckets);
+  for(auto &sb : size_buckets.buckets) {
+    cf.put(sb.count);
+    cf.put(sb.actual_fraction);
+  }
+  saveRank(cf, size_buckets);
+  for(auto &db : dir_buckets.buckets) {
+    cf.put(db.count);
+    cf.put(db.actual_fraction);
+  }
+  saveRank(cf, dir_buckets);
+
+  cf.put(file_table.next_id);
+  cf.put(file_table.free_head);
+  cf.put(file_table.live);
+  cf.put(file_table.high_water);
+  for(uint32_t id=0; id<file_table.next_id; id+=FileTable::CHUNK_FILES) {
+    cf.putArray(&file_table[id],
+        std::min((uint32_t) FileTable::CHUNK_FILES, file_table.next_id - id));
+  }
+  cf.put(global_file_list->count);
+  for(auto i=0; i<NUM_AGES*NUM_SIZES*NUM_DIRS; i++) {
+    cf.putVector(file_cells[i].files);
+  }
+  cf.put((uint64_t) CheckpointFile::MAGIC);
+}
+
+/* load a checkpoint into the model init() has just set up */
+static int loadModel(CheckpointFile &cf) {
+  uint64_t magic = 0, capacity = 0, live_data = 0, workload = 0;
+  int64_t saved_seed = 0;
+  int32_t ages = 0, sizes = 0, dirs = 0;
+  cf.get(magic);
+  cf.get(saved_seed);
+  cf.get(capacity);
+  cf.get(ages);
+  cf.get(sizes);
+  cf.get(dirs);
+  if(cf.failed || (magic != CheckpointFile::MAGIC)) {
+    fprintf(stderr, "error: %s is not a checkpoint\n", cf.path.c_str());
+    return -1;
+  }
+  if((saved_seed != seed) || (capacity != total_disk_capacity) ||
+      (ages != NUM_AGES) || (sizes != NUM_SIZES) || (dirs != NUM_DIRS)) {
+    fprintf(stderr, "error: %s was taken with a different seed, "
+        "disk size or profile\n", cf.path.c_str());
+    return -1;
+  }
+
+  cf.get(tick);
+  cf.get(K);
+  cf.get(global_live_file_count);
+  cf.get(live_data);
+  cf.get(workload);
+  live_data_size = live_data;
+  workload_size = workload;
+  cf.get(age_cutoff_tick);
+  cf.get(rand_calls);
+  std::string gen;
+  cf.getString(gen);
+  std::istringstream(gen) >> victim_gen;
+
+  for(auto &ab : age_buckets.buckets) {
+    cf.get(ab.f);
+    cf.get(ab.last);
+    cf.get(ab.count);
+    cf.get(ab.cutoff);
+    cf.get(ab.actual_fraction);
+  }
+  loadRank(cf, age_buckets);
+  for(auto &sb : size_buckets.buckets) {
+    cf.get(sb.count);
+    cf.get(sb.actual_fraction);
+  }
+  loadRank(cf, size_buckets);
+  for(auto &db : dir_buckets.buckets) {
+    cf.get(db.count);
+    cf.get(db.actual_fraction);
+  }
+  loadRank(cf, dir_buckets);
+
+  uint32_t next_id = 0, free_head = 0;
+  uint64_t live = 0, high_water = 0;
+  cf.get(next_id);
+  cf.get(free_head);
+  cf.get(live);
+  cf.get(high_water);
+  if(cf.failed || (next_id == 0)) {
+    fprintf(stderr, "error: %s is truncated\n", cf.path.c_str());
+    return -1;
+  }
+  file_table.restore(next_id, free_head, live, high_water);
+  for(uint32_t id=0; id<next_id; id+=FileTable::CHUNK_FILES) {
+    cf.getArray(&file_table[id],
+        std::min((uint32_t) FileTable::CHUNK_FILES, next_id - id));
+  }
+  cf.get(global_file_list->count);
+  for(auto i=0; i<NUM_AGES*NUM_SIZES*NUM_DIRS; i++) {
+    cf.getVector(file_cells[i].files);
+  }
+  magic = 0;
+  cf.get(magic);
+  if(cf.failed || (magic != CheckpointFile::MAGIC)) {
+    fprintf(stderr, "error: %s is truncated\n", cf.path.c_str());
+    return -1;
+  }
+
+  // bring rand() to where it was
+  for(uint64_t i=0; i<rand_calls; i++) {
+    rand();
+  }
+  return 0;
+}
+
+static int writeCheckpoint() {
+  CheckpointFile cf;
+  if(cf.openWrite(checkpointPath()) < 0) {
+    return -1;
+  }
+  saveModel(cf);
+  return cf.commit();
+}
+
+int loadCheckpoint() {
+  CheckpointFile cf;
+  if(cf.openRead(checkpointPath()) < 0) {
+    fprintf(stderr, "error: cannot open checkpoint %s: %s\n",
+        checkpointPath().c_str(), strerror(errno));
+    return -1;
+  }
+  return loadModel(cf);
+}
+
+/*
+ * Adopting an aged image.  Every file geriatrix creates is named after
+ * the tick it was created at and sits in the directory of its dir bucket
+ * (and sibling dir), with its size class's allocation size, so the model
+ * can be rebuilt from a scan of the image: dir keys map the directories
+ * back to (dir bucket, sibling dir) and sizes map back to size buckets.
+ * Files are put into the youngest age bucket in age order, exactly as
+ * after the rapid fill, and the first reAge() of stable aging sorts them
+ * into their age buckets.
+ */
+static boost::unordered_map<std::string, int> adopt_dirs; // rel path -> key
+static std::vector<std::pair<uint16_t, uint32_t> > adopt_slots; // key ->
+                                                                // (dir, subdir)
+
+static int classifyDir(const std::string &rel_path) {
+  auto it = adopt_dirs.find(rel_path);
+  return (it == adopt_dirs.end()) ? -1 : it->second;
+}
+
+int adoptImage(int threads) {
+  for(auto &db : dir_buckets.buckets) {
+    uint32_t subdirs = ((db.depth > 0) && (db.sibling_dirs > 0)) ?
+      db.sibling_dirs : 0;
+    for(uint32_t j = (subdirs > 0) ? 1 : 0; j <= subdirs; j++) {
+      auto rel = fileDir(db.id, j);
+      if(adopt_dirs.find(rel) == adopt_dirs.end()) {
+        adopt_dirs[rel] = adopt_slots.size();
+        adopt_slots.push_back(std::make_pair(db.id, j));
+      }
+    }
+  }
+  boost::unordered_map<uint64_t, int> sizes; // allocated size -> bucket
+  for(auto &sb : size_buckets.buckets) {
+    auto in = sizes.insert(std::make_pair(File::allocSize(sb.size), sb.id));
+    if(!in.second) {
+      // the file's size could not tell which of the two it came from
+      fprintf(stderr, "error: size buckets %d and %d both allocate %lu "
+          "bytes, cannot adopt\n", in.first->second, sb.id,
+          (unsigned long) in.first->first);
+      return -1;
+    }
+  }
+
+  ImageScanner scan(mount_point, classifyDir);
+  auto rv = scan.run(threads);
+  if(rv < 0) {
+    fprintf(stderr, "error: scanning %s: %s\n", mount_point.c_str(),
+        strerror(-rv));
+    return -1;
+  }
+  std::sort(scan.entries.begin(), scan.entries.end(),
+      [](const ScanEntry &x, const ScanEntry &y) { return x.age < y.age; });
+
+  uint64_t adopted = 0;
+  for(auto &e : scan.entries) {
+    auto it = sizes.find(e.size);
+    if(it == sizes.end()) {
+      scan.skipped++;
+      continue;
+    }
+    auto &sb = size_buckets[it->second];
+    auto &slot = adopt_slots[e.dir];
+    auto f = file_table.alloc();
+    file_table[f].age = e.age;
+    file_table[f].size_id = sb.id;
+    file_table[f].dir_id = slot.first;
+    file_table[f].subdir = slot.second;
+    global_live_file_count++;
+    dir_buckets[slot.first].count++;
+    global_file_list->addFile(f);
+    sb.count++;
+    age_buckets[0].addFile(f, global_live_file_count, false);
+    live_data_size += sb.size;
+    tick = std::max(tick, e.age);
+    adopted++;
+  }
+  adopt_dirs.clear();
+  adopt_slots.clear();
+  if(adopted == 0) {
+    fprintf(stderr, "error: found no files to adopt under %s\n",
+        mount_point.c_str());
+    return -1;
+  }
+  dir_buckets.reRank(global_live_file_count);
+  size_buckets.reRank(global_live_file_count);
+  age_buckets.update(0);
+  // the fill that made this image created (about) as many files as it holds
+  K = adopted;
+
+  std::cout << "Adopted " << adopted << " files (" <<
+    live_data_size / 1048576 << " MB) in " << scan.dirs <<
+    " dirs from " << mount_point << ", last operation " << tick <<
+    ", skipped " << scan.skipped << " other files" << std::endl;
+  return 0;
+}
+
+/*
+ * --track on an existing image: note where the data of the files already
+ * there is, which rollback need not compare with the golden image
+ */
+int trackBase(int threads) {
+  std::vector<uint32_t> files;
+  auto fs = global_file_list->fs;
+  for(auto f = file_table[fs].next; f != fs; f = file_table[f].next) {
+    files.push_back(f);
+  }
+  std::atomic<size_t> next(0);
+  std::atomic<int> failed(0);
+  std::vector<std::thread> workers;
+  for(int t=0; t<std::max(threads, 1); t++) {
+    workers.emplace_back([&files, &next, &failed] {
+      char path[PATH_MAX];
+      for(auto i = next++; (i < files.size()) && (failed.load() == 0);
+          i = next++) {
+        file_table[files[i]].getPath(path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        if((fd < 0) && (errno == ENOENT) && resumed) {
+          continue; // not made yet when the checkpoint was taken
+        }
+        if((fd < 0) || (change_map->addFile(fd, ChangeMap::BASE) < 0)) {
+          failed = errno;
+          fprintf(stderr, "error: tracking %s: %s\n", path, strerror(errno));
+        }
+        if(fd >= 0) {
+          close(fd);
+        }
+      }
+    });
+  }
+  for(auto &w : workers) {
+    w.join();
+  }
+  if(failed.load() != 0) {
+    return -1;
+  }
+  std::cout << "Tracking changes to " << mount_point << ": " <<
+    change_map->base.count() * ChangeMap::BLOCK / 1048576 <<
+    " MB of file data there already" << std::endl;
+  return 0;
+}
+
+/* write the changed block map, if tracking went well */
+static void saveChangeMap() {
+  if(!change_map) {
+    return;
+  }
+  if(track_errno.load() != 0) {
+    fprintf(stderr, "warning: tracking changed blocks failed (%s), no map "
+        "written; use rollback -d\n", strerror(track_errno.load()));
+  } else if(change_map->save(track_file) < 0) {
+    fprintf(stderr, "warning: writing %s failed: %s\n", track_file,
+        strerror(errno));
+  }
+}
+
+static pid_t checkpoint_pid = 0; // child writing a checkpoint, if any
+
+/*
+ * reap the child writing the last checkpoint.  returns 1 if it is still
+ * busy (and block is false), 0 otherwise.
+ */
+static int waitCheckpoint(bool block) {
+  int status = 0;
+  if(checkpoint_pid <= 0) {
+    return 0;
+  }
+  auto rv = waitpid(checkpoint_pid, &status, block ? 0 : WNOHANG);
+  if(rv == 0) {
+    return 1;
+  }
+  checkpoint_pid = 0;
+  if((rv < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+    fprintf(stderr, "warning: writing checkpoint %s failed\n",
+        checkpointPath().c_str());
+  }
+  return 0;
+}
+
+/*
+ * Save the model.  Everything queued so far is completed first so the
+ * image matches the model.  In the background case we then fork and the
+ * child writes its copy-on-write snapshot of the model while aging goes
+ * on; a checkpoint is skipped if the previous one is still being written.
+ */
+void checkpoint(bool background) {
+  if(waitCheckpoint(!background) > 0) {
+    return;
+  }
+  io->drain();
+#ifdef HAVE_IO_URING
+  if(uring) {
+    uring->drain();
+  }
+#endif
+  if(background) {
+    fflush(stdout);
+    fflush(stderr);
+    auto pid = fork();
+    if(pid == 0) {
+      _exit(writeCheckpoint() == 0 ? 0 : 1);
+    } else if(pid > 0) {
+      checkpoint_pid = pid;
+      return;
+    }
+  }
+  if(writeCheckpoint() < 0) {
+    fprintf(stderr, "warning: writing checkpoint %s failed: %s\n",
+        checkpointPath().c_str(), strerror(errno));
+  }
+}
+
 int performOp(bool create, int size_arr_position,
     int idle_injections, struct age *a, struct size *s, struct dir *d) {
   tick++;
@@ -871,12 +1529,85 @@ int performOp(bool create, int size_arr_position,
   return 0;
 }
 
+/* one file of the rapid aging fill */
+struct FillOp {
+  uint16_t size_id;
+  uint16_t dir_id;
+  uint32_t subdir;
+};
+
+/*
+ * Queue the creates of a fill, whose ages are first_age, first_age+1, ...
+ * Files are grouped by directory and each run of FILL_BATCH files of one
+ * directory goes to a single worker, so workers mostly insert into
+ * directories nobody else is touching.  Nothing else is queued until the
+ * fill has drained, so the creates need not go to their files' shards.
+ */
+#define FILL_BATCH 1024
+static void issueFill(const std::vector<FillOp> &plan, uint64_t first_age) {
+  std::vector<uint32_t> order(plan.size());
+  for(size_t i=0; i<order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&plan](uint32_t x,
+        uint32_t y) {
+      return (plan[x].dir_id < plan[y].dir_id) ||
+        ((plan[x].dir_id == plan[y].dir_id) &&
+         (plan[x].subdir < plan[y].subdir));
+  });
+  uint64_t batch = 0;
+  size_t in_batch = 0;
+  for(size_t i=0; i<order.size(); i++) {
+    auto &p = plan[order[i]];
+    if((i > 0) && ((++in_batch == FILL_BATCH) ||
+          (p.dir_id != plan[order[i-1]].dir_id) ||
+          (p.subdir != plan[order[i-1]].subdir))) {
+      batch++;
+      in_batch = 0;
+    }
+    IoOp op;
+    op.age = first_age + order[i];
+    op.len = File::allocSize(size_buckets[p.size_id].size);
+    op.subdir = p.subdir;
+    op.dir_id = p.dir_id;
+    op.type = IoOp::CREATE;
+#ifdef HAVE_IO_URING
+    if(uring) {
+      char buf[PATH_MAX];
+      buildPath(buf, sizeof(buf), op.dir_id, op.subdir, op.age);
+      uring->create(buf, op.len);
+      continue;
+    }
+#endif
+    io->submit(op, batch);
+  }
+#ifdef HAVE_IO_URING
+  if(uring) {
+    uring->drain();
+  }
+#endif
+  io->drain();
+}
+
+/*
+ * Rapid aging only ever creates files, and which file comes next depends
+ * on nothing but the size draw and the dir ranking, so instead of going
+ * through performOp() for every file we plan the whole fill first, then
+ * build the model in one pass and only then queue the creates, grouped by
+ * directory.  The size and age rankings are refreshed once at the end;
+ * the files, their order and every rand() draw are the same as with one
+ * performOp() per file.
+ */
 int performRapidAging(size_t till_size, int idle_injections,
     struct age *a, struct size *s, struct dir *d) {
   boost::random::mt19937 gen{static_cast<std::uint64_t>(total_size_weight)};
   boost::random::uniform_int_distribution<std::uint64_t> dist{1,
     static_cast<std::uint64_t>(total_size_weight)};
-  while(live_data_size < till_size) {
+
+  // plan: only the dir ranking has to be kept current while choosing
+  std::vector<FillOp> plan;
+  auto planned = live_data_size;
+  while(planned < till_size) {
     auto rand = dist(gen);
     int j = 0;
     while(rand > s->cutoffs[j]) {
@@ -886,7 +1617,45 @@ int performRapidAging(size_t till_size, int idle_injections,
         break;
       }
     }
-    performOp(true, j, idle_injections, a, s, d);
+    auto &sb = size_buckets[j];
+    auto &db = dir_buckets.at(0);
+    FillOp op;
+    op.size_id = sb.id;
+    op.dir_id = db.id;
+    op.subdir = pickSubdir(db);
+    plan.push_back(op);
+    global_live_file_count++;
+    db.count++;
+    dir_buckets.reRank(global_live_file_count);
+    sb.count++;
+    planned += sb.size;
+  }
+
+  // build the model
+  auto first_age = tick + 1;
+  for(auto &op : plan) {
+    auto f = file_table.alloc();
+    file_table[f].age = ++tick;
+    file_table[f].size_id = op.size_id;
+    file_table[f].dir_id = op.dir_id;
+    file_table[f].subdir = op.subdir;
+    global_file_list->addFile(f);
+    age_buckets[0].addFile(f, global_live_file_count, false);
+    if(record_file) {
+      trace.create(tick, tick, traceDirKey(op.dir_id, op.subdir),
+          File::allocSize(size_buckets[op.size_id].size));
+    }
+  }
+  size_buckets.reRank(global_live_file_count);
+  age_buckets.update(0);
+  workload_size += planned - live_data_size;
+  live_data_size = planned;
+
+  if(!fake) {
+    issueFill(plan, first_age);
+  }
+  if(record_file) {
+    trace.drain(tick); // the fill is complete before aging starts
   }
   return 0;
 }
@@ -895,7 +1664,6 @@ int performStableAging(size_t till_size, int idle_injections,
     struct age *a, struct size *s, struct dir *d, int runs) {
   auto future_tick = calculateT(a);
   reAge(a, future_tick);
-  int confidence_met = 0;
   AGING_TRIGGER trigger = none;
   do {
     if(tossCoin() < 0.5) {
@@ -915,13 +1683,21 @@ int performStableAging(size_t till_size, int idle_injections,
         ", Operations = " << tick << "..." << std::endl;
       dumpSizeBuckets();
       dumpDirBuckets();
-      auto confidence_met = dumpAgeBuckets(a->out_file, s->out_file,
-          d->out_file);
-      if(confidence > 0 && confidence_met == 1) {
-        return 1;
+      dumpFragmentation(frag_out_file);
+      dumpAgeBuckets(a->out_file);
+      for(auto &t : fit_targets) {
+        t.fit->recompute();
+      }
+      if((checkpoint_interval > 0) && (std::chrono::duration<double>(end -
+              last_checkpoint).count() >= checkpoint_interval * 60)) {
+        checkpoint(true);
+        last_checkpoint = end;
       }
     }
-    if(tick >= future_tick) {
+    if(stop_requested) {
+      std::cout << "Aging stopped because it was interrupted." << std::endl;
+      trigger = interrupted;
+    } else if(tick >= future_tick) {
       trigger = convergence;
       std::cout <<
         "Aging stopped due to perfect convergence in relative age distribution."
@@ -934,7 +1710,7 @@ int performStableAging(size_t till_size, int idle_injections,
       std::cout << "Aging stopped because of reaching runtime limit."
         << std::endl;
       trigger = exec_time;
-    } else if(confidence > 0 && confidence_met == 1) {
+    } else if(accuracyMet()) {
       std::cout << "Aging stopped because of meeting intended aging accuracy."
         << std::endl;
       trigger = accuracy;
@@ -943,6 +1719,133 @@ int performStableAging(size_t till_size, int idle_injections,
   return trigger;
 }
 
+/*
+ * --replay: perform the ops of a trace recorded with --record, in the
+ * order they were recorded and with no model at all, so the run is only
+ * limited by the backend.  The trace's dirs are made as they first show
+ * up.  Ops go to the I/O workers (or io_uring) as in an aging run, by
+ * file name, so a file is still never unlinked before it is created.
+ */
+static std::vector<std::string> replay_dirs; // "<mount point>/<dir>/"
+
+static void runReplayOp(const IoOp &op) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s%" PRIu64, replay_dirs[op.subdir].c_str(),
+      op.age);
+  if(op.type == IoOp::CREATE) {
+    issueCreate(path, op.len);
+  } else {
+    issueDelete(path);
+  }
+}
+
+static void replayDrain() {
+#ifdef HAVE_IO_URING
+  if(uring) {
+    uring->drain();
+  }
+#endif
+  io->drain();
+}
+
+int replayTrace(int concurrency, size_t window) {
+  TraceReader reader;
+  if(reader.open(replay_file) < 0) {
+    fprintf(stderr, "error: cannot replay %s: %s\n", replay_file,
+        errno == EINVAL ? "not an op trace" : strerror(errno));
+    return -1;
+  }
+  if(mkdir_path(mount_point.c_str(), 0777) < 0) {
+    fprintf(stderr, "error: mkdir %s: %s\n", mount_point.c_str(),
+        strerror(errno));
+    return -1;
+  }
+  io = new IoExecutor(concurrency, window, runReplayOp);
+#ifdef HAVE_IO_URING
+  if(uring) {
+    uring->op_stats = &op_stats;
+  }
+#endif
+  if(stats_prefix &&
+      (timeline.start((std::string(stats_prefix) + ".timeline.csv").c_str(),
+                      sample_interval, &op_stats, ioInflight) < 0)) {
+    fprintf(stderr, "error: cannot write %s.timeline.csv: %s\n",
+        stats_prefix, strerror(errno));
+    return -1;
+  }
+  auto t0 = std::chrono::high_resolution_clock::now();
+  uint64_t ops = 0, bytes = 0;
+  TraceReader::Op t;
+  while(reader.next(t)) {
+    if(t.kind == OpTrace::DEFINE) {
+      auto &rel = reader.dir(t.dir);
+      auto path = mount_point + "/" + rel;
+      if(!rel.empty() && (mkdir_path(path.c_str(), 0777) < 0)) {
+        fprintf(stderr, "error: mkdir %s: %s\n", path.c_str(),
+            strerror(errno));
+        return -1;
+      }
+      if(replay_dirs.size() == replay_dirs.capacity()) {
+        io->drain(); // the workers read replay_dirs
+      }
+      replay_dirs.push_back(rel.empty() ? mount_point + "/" : path + "/");
+      continue;
+    }
+    if(t.kind == OpTrace::DRAIN) {
+      replayDrain();
+      continue;
+    }
+    IoOp op;
+    op.age = t.age;
+    op.len = t.len;
+    op.subdir = t.dir;
+    op.dir_id = 0;
+    op.type = (t.kind == OpTrace::CREATE) ? IoOp::CREATE : IoOp::DELETE;
+    ops++;
+    bytes += op.len;
+    if((ops % 1000000) == 0) {
+      std::cout << "Replayed " << ops << " operations (" <<
+        (int) (reader.progress() * 100) << "% of the trace)..." << std::endl;
+    }
+#ifdef HAVE_IO_URING
+    if(uring) {
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "%s%" PRIu64,
+          replay_dirs[op.subdir].c_str(), op.age);
+      if(op.type == IoOp::CREATE) {
+        uring->create(path, op.len);
+      } else {
+        uring->unlink(path);
+      }
+      continue;
+    }
+#endif
+    io->submit(op);
+  }
+  replayDrain();
+  timeline.stop();
+  saveChangeMap();
+  if(reader.truncated) {
+    fprintf(stderr, "warning: %s is truncated or corrupt, replayed the "
+        "first %" PRIu64 " operations\n", replay_file, ops);
+  }
+  double secs = std::chrono::duration<double>(
+      std::chrono::high_resolution_clock::now() - t0).count();
+  dumpFragmentation(frag_out_file);
+  std::cout << "============= REPLAY STATISTICS ================" << std::endl;
+  std::cout << " Replayed " << ops << " operations (" << bytes / 1048576 <<
+    " MB) from " << replay_file << " in " << secs << " secs, " <<
+    ops / std::max(secs, 1e-9) << " ops/sec" << std::endl;
+  dumpIoStats();
+  if(change_map && (track_errno.load() == 0)) {
+    std::cout << " Changed block map (" << change_map->changed.count() *
+      ChangeMap::BLOCK / 1048576 << " MB changed) saved in " << track_file <<
+      std::endl;
+  }
+  std::cout << "================================================" << std::endl;
+  return 0;
+}
+
 void usage() {
   std::cout << std::endl;
   std::cout << "geriatrix " << std::endl;
@@ -963,7 +1866,29 @@ void usage() {
   std::cout << "        -c <confidence fraction between 0 and 1>" << std::endl;
   std::cout << "        -q <0 / 1 ask before quitting>" << std::endl;
   std::cout << "        -w <num mins>" << std::endl;
-  std::cout << "        -b <backend (posix, deltafs, etc.)>" << std::endl;
+  std::cout << "        -b <backend (posix, io_uring, memfs[:<allocator>], " <<
+    "deltafs)>" << std::endl;
+  std::cout << "           allocator: next-fit (default), first-fit, " <<
+    "best-fit, buddy, ext4" << std::endl;
+  std::cout << "        [-o <max ops in flight (default " << IO_WINDOW <<
+    ")>]" << std::endl;
+  std::cout << "        [-k <mins between checkpoints>]" << std::endl;
+  std::cout << "        [--resume | --adopt]" << std::endl;
+  std::cout << "        [-l <timeline and latency csv prefix>" <<
+    " [--sample-interval <secs>]]" << std::endl;
+  std::cout << "        [-g <memfs fragmentation out file>]" << std::endl;
+  std::cout << "        [--size-confidence <fraction>] " <<
+    "[--dir-confidence <fraction>]" << std::endl;
+  std::cout << "        [--record <op trace out file>]" << std::endl;
+  std::cout << "        [--track <changed block map out file (posix)>]" <<
+    std::endl;
+  std::cout << "   or:  --replay <op trace> -m <mount point> -t <t-way " <<
+    "concurrency>" << std::endl;
+  std::cout << "        [-b <backend>] [-n <memfs size>] [-o <max ops in " <<
+    "flight>]" << std::endl;
+  std::cout << "        [-l <csv prefix> [--sample-interval <secs>]] " <<
+    "[-g <memfs fragmentation out file>]" << std::endl;
+  std::cout << "        [--track <changed block map out file>]" << std::endl;
   std::cout << std::endl;
 }
 
@@ -971,9 +1896,9 @@ int resumeAgingQuery(uint64_t total_disk_capacity, double runtime) {
   auto decision = 'x';
   std::cout << "=================== Aging trigger fired  ====================="
     << std::endl;
-  if(confidence > 0) {
-    std::cout << "Accuracy at this point = " <<
-      dumpAgeBuckets(NULL, NULL, NULL, 1) << std::endl;
+  if(accuracyRequested()) {
+    std::cout << "Accuracy at this point:" << std::endl;
+    printAccuracy();
   } else {
     std::cout << "Perfect convergence mode selected." << std::endl;
   }
@@ -988,12 +1913,14 @@ int resumeAgingQuery(uint64_t total_disk_capacity, double runtime) {
   if(decision == 'y') {
     std::cout << "=================================================="
       << std::endl;
-    if(confidence > 0) {
-      std::cout << "Current confidence level set = " << confidence << "."
-        << std::endl;
-      std::cout << "Enter new confidence level (fraction between 0 and 1): ";
-      std::cin >> confidence;
-      std::cout << std::endl;
+    for(auto &t : fit_targets) {
+      if(*t.target > 0) {
+        std::cout << "Current " << t.name << " confidence level set = " <<
+          *t.target << "." << std::endl;
+        std::cout << "Enter new confidence level (fraction between 0 and 1): ";
+        std::cin >> *t.target;
+        std::cout << std::endl;
+      }
     }
     std::cout << "Aging currently ran for " << runtime << " mins." << std::endl;
     std::cout <<
@@ -1015,30 +1942,66 @@ int resumeAgingQuery(uint64_t total_disk_capacity, double runtime) {
   return 0;
 }
 
+/*
+ * SIGINT: only note it, the planner stops at the end of the op it is in
+ * and finishRun() then runs on the normal path.  Doing the drain and the
+ * dumps here could deadlock on a lock the interrupted thread holds.
+ */
 void handler(int signo){
+  stop_requested = 1;
+}
+
+/* wait for every op, write the dumps and statistics, and exit */
+void finishRun() {
+  // let queued I/O finish so the latencies and timeline cover every op
+  io->drain();
+#ifdef HAVE_IO_URING
+  if(uring) {
+    uring->drain();
+  }
+#endif
+  timeline.stop();
+  saveChangeMap();
+  if(record_file && (trace.close() < 0)) {
+    fprintf(stderr, "warning: writing op trace %s failed: %s\n",
+        record_file, strerror(errno));
+  }
+  stats_writer.stop(); // the periodic dumps, the last ones are written here
   dumpAgeBuckets(a.out_file);
   dumpSizeBuckets(s.out_file);
   dumpDirBuckets(d.out_file);
+  dumpFragmentation(frag_out_file);
   dumpStats(&a, &s, &d);
   destroy();
   exit(0);
 }
 
 int main(int argc, char *argv[]) {
-  if(argc != 37) {
-    usage();
-    exit(1);
-  }
   char *mybackend = NULL;
   //uint64_t total_disk_capacity = 0;
   double utilization = 0.0;
-  int seed = 0;
   int option = 0;
+  int resume = 0;
+  int adopt = 0;
   int concurrency = 0;
   int idle_injections = 0;
   int query_before_quitting = 0;
-  while((option = getopt(argc, argv,
-                         "n:u:r:m:a:s:d:x:y:z:t:i:f:p:c:q:w:b:")) != EOF) {
+  size_t window = IO_WINDOW;
+  static struct option long_options[] = {
+    {"resume", no_argument, NULL, 'R'},
+    {"adopt", no_argument, NULL, 'A'},
+    {"checkpoint", required_argument, NULL, 'k'},
+    {"sample-interval", required_argument, NULL, 'S'},
+    {"record", required_argument, NULL, 'T'},
+    {"replay", required_argument, NULL, 'P'},
+    {"track", required_argument, NULL, 'C'},
+    {"size-confidence", required_argument, NULL, 'Y'},
+    {"dir-confidence", required_argument, NULL, 'Z'},
+    {NULL, 0, NULL, 0}
+  };
+  while((option = getopt_long(argc, argv,
+                         "n:u:r:m:a:s:d:x:y:z:t:i:f:p:c:q:w:b:o:k:l:g:",
+                         long_options, NULL)) != EOF) {
     switch(option) {
       case 'n': total_disk_capacity = strtoull(optarg, NULL, 10); break;
       case 'u': utilization = strtod(optarg, NULL); break;
@@ -1058,10 +2021,61 @@ int main(int argc, char *argv[]) {
       case 'q': query_before_quitting = atoi(optarg); break;
       case 'w': runtime_max = atoi(optarg); break;
       case 'b': mybackend = optarg; break;
+      case 'o': window = strtoull(optarg, NULL, 10); break;
+      case 'k': checkpoint_interval = strtod(optarg, NULL); break;
+      case 'l': stats_prefix = optarg; break;
+      case 'S': sample_interval = strtod(optarg, NULL); break;
+      case 'g': frag_out_file = optarg; break;
+      case 'T': record_file = optarg; break;
+      case 'P': replay_file = optarg; break;
+      case 'C': track_file = optarg; break;
+      case 'Y': size_confidence = strtod(optarg, NULL); break;
+      case 'Z': dir_confidence = strtod(optarg, NULL); break;
+      case 'R': resume = 1; break;
+      case 'A': adopt = 1; break;
     }
   }
+  // a replay needs no profile, everything else all 18 options
+  if((replay_file ? (mount_point.empty() || record_file) : (argc < 37)) ||
+      (window == 0) || (resume && adopt) || !(sample_interval > 0)) {
+    usage();
+    exit(1);
+  }
   if (!mybackend || strcmp(mybackend, "posix") == 0) {
       /* do nothing, posix is the default */
+  } else if (strcmp(mybackend, "io_uring") == 0) {
+#ifdef HAVE_IO_URING
+      /* posix through io_uring, falls back to the I/O workers */
+      if (!fake) {
+          uring = new UringExecutor(std::min(window, (size_t) URING_DEPTH));
+          if (uring->init() < 0) {
+              fprintf(stderr, "warning: io_uring unavailable (%s), "
+                      "using posix\n", strerror(errno));
+              delete uring;
+              uring = NULL;
+          }
+      }
+#else
+      fprintf(stderr, "warning: io_uring not enabled in this binary, "
+              "using posix\n");
+#endif
+  } else if (strncmp(mybackend, "memfs", 5) == 0 &&
+             (mybackend[5] == '\0' || mybackend[5] == ':')) {
+      /* simulated in memory, sized like the disk (-n) */
+      const char *policy = mybackend[5] ? mybackend + 6 : "next-fit";
+      BlockAllocator *alloc = BlockAllocator::create(policy,
+              total_disk_capacity / MemFs::BLOCK);
+      if (alloc == NULL) {
+          fprintf(stderr, "error: no memfs allocator %s\n", policy);
+          exit(1);
+      }
+      if (adopt || resume) {
+          fprintf(stderr, "error: a memfs starts empty, nothing to %s\n",
+                  adopt ? "adopt" : "resume");
+          exit(1);
+      }
+      memfs = new MemFs(alloc);
+      g_backend = &memfs_backend_driver;
   } else if (strcmp(mybackend, "deltafs") == 0) {
 #ifdef DELTAFS
       g_backend = &deltafs_backend_driver;
@@ -1071,31 +2085,101 @@ int main(int argc, char *argv[]) {
 #endif
   }
 
+  if(track_file) {
+    // FIEMAP needs the files, and to see every create and delete
+    bool posix = (g_backend == &posix_backend_driver);
+#ifdef HAVE_IO_URING
+    posix = posix && !uring;
+#endif
+    if(!posix || fake) {
+      fprintf(stderr, "error: --track needs -b posix and -f 0\n");
+      exit(1);
+    }
+    change_map = new ChangeMap();
+  }
+  if(replay_file) {
+    auto rv = replayTrace(concurrency, window);
+    destroy();
+    exit(rv < 0 ? 1 : 0);
+  }
+
   assert(total_disk_capacity > 0);
   srand(seed);
+  victim_gen.seed(seed);
 
   init(&a, &s, &d); // initialize the data structures for aging
-  if(confidence > 0.0) {
-    // initialize the chi-squared value for accuracy comparison.
-    dist = new boost::math::chi_squared(NUM_AGES - 1);
-    goodness_measure = cdf(*dist, confidence);
-  }
-  pool = new ThreadPool(concurrency);
-  performRapidAging(total_disk_capacity * utilization, idle_injections,
-      &a, &s, &d);
-  K = tick;
+  if(!fake && (makeDirs(concurrency) < 0)) {
+    exit(1);
+  }
+  io = new IoExecutor(concurrency, window, runOp);
+#ifdef HAVE_IO_URING
+  if(uring) {
+    uring->op_stats = &op_stats;
+  }
+#endif
+  if(stats_prefix && !fake &&
+      (timeline.start((std::string(stats_prefix) + ".timeline.csv").c_str(),
+                      sample_interval, &op_stats, ioInflight) < 0)) {
+    fprintf(stderr, "error: cannot write %s.timeline.csv: %s\n",
+        stats_prefix, strerror(errno));
+    exit(1);
+  }
+  if(record_file) {
+    if(trace.open(record_file, traceDirName) < 0) {
+      fprintf(stderr, "error: cannot write %s: %s\n", record_file,
+          strerror(errno));
+      exit(1);
+    }
+    // the whole tree makeDirs() made, so the replay makes it first too
+    for(auto &level : dirLevels()) {
+      for(auto &e : level) {
+        trace.defineDir(e.first, e.second);
+      }
+    }
+    trace.drain(tick);
+  }
+  if(resume) {
+    // pick up the model where the checkpoint left it, skip the rapid fill
+    if(loadCheckpoint() < 0) {
+      exit(1);
+    }
+    resumed = 1;
+#ifdef HAVE_IO_URING
+    if(uring) {
+      uring->replaying = true;
+    }
+#endif
+    std::cout << "Resuming aging from " << checkpointPath() <<
+      " at operation " << tick << std::endl;
+  } else if(adopt) {
+    // rebuild the model from the image instead of filling it
+    if(adoptImage(concurrency) < 0) {
+      exit(1);
+    }
+  } else {
+    performRapidAging(total_disk_capacity * utilization, idle_injections,
+        &a, &s, &d);
+    K = tick;
+  }
+  if(change_map && (resume || adopt) && (trackBase(concurrency) < 0)) {
+    exit(1);
+  }
   struct sigaction sigIntHandler;
 
   sigIntHandler.sa_handler = handler;
   sigemptyset(&sigIntHandler.sa_mask);
-  sigIntHandler.sa_flags = 0;
+  sigIntHandler.sa_flags = SA_RESTART;
   sigaction(SIGINT, &sigIntHandler, NULL);
 
+  stats_writer.start();
   do {
     performStableAging(total_disk_capacity * runs, idle_injections,
         &a, &s, &d, runs);
-  } while(query_before_quitting && resumeAgingQuery(total_disk_capacity,
-        runtime));
-  handler(0);
+  } while(query_before_quitting && !stop_requested &&
+      resumeAgingQuery(total_disk_capacity, runtime));
+  if((checkpoint_interval > 0) && !stop_requested) {
+    checkpoint(false); // so the aged image can be resumed later on
+  }
+  finishRun();
   return 0;
 }
@@ -13,11 +13,10 @@
 #include <boost/container/vector.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/container/flat_map.hpp>
-#include <boost/tokenizer.hpp>
 #include <boost/random.hpp>
-#include <boost/math/distributions/chi_squared.hpp>
 #include <chrono>
 #include <fstream>
+#include <map>
 #include <getopt.h>
 #include <atomic>
 #include <mutex>
@@ -27,12 +26,27 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <signal.h>
+#include <sys/wait.h>
+#include <sstream>
+#include <stdarg.h>
 //#include <gperftools/profiler.h>
-#include "ThreadPool.h"
+#include "io_executor.h"
 
 #include "age_bucket.h"
 #include "age_list.h"
+#include "bucket_rank.h"
+#include "change_map.h"
+#include "checkpoint.h"
+#include "image_scan.h"
+#include "lazy_mt.h"
+#include "memfs.h"
+#include "op_stats.h"
+#include "op_trace.h"
+#include "stats_writer.h"
 #include "backend_driver.h"
+#ifdef HAVE_IO_URING
+#include "uring_executor.h"
+#endif
 
 using namespace boost::container;
 using namespace boost::unordered;
@@ -56,7 +70,6 @@ struct size {
   double *distribution;
   size_t *arr;
   double *cutoffs;
-  unordered_map<int, std::string> bucket_keys;
 } s;
 
 struct dir {
@@ -65,7 +78,6 @@ struct dir {
   double *distribution;
   int *arr;
   uint32_t *subdir_arr;
-  unordered_map<int, std::string> bucket_keys;
 } d;
 
 struct age {
@@ -73,19 +85,37 @@ struct age {
   char *out_file;
   double *distribution;
   double *cutoffs;
-  unordered_map<int, std::string> bucket_keys;
 } a;
 
-double confidence = 0.0;
-boost::math::chi_squared *dist;
-double goodness_measure = 0.0;
+double confidence = 0.0; // -c: stop at this chi-squared distance
+double size_confidence = 0.0; // --size-confidence: same for sizes
+double dir_confidence = 0.0; // --dir-confidence: same for dir depths
 auto start = std::chrono::high_resolution_clock::now();
 int runtime_max = 0;
 double runtime = 0;
 int runs = 0;
 uint64_t K = 0;
+int seed = 0;
+uint64_t rand_calls = 0; // rand() draws so far, replayed by --resume
+double checkpoint_interval = 0; // mins between checkpoints, 0 for none
+auto last_checkpoint = std::chrono::high_resolution_clock::now();
+int resumed = 0; // continuing from a checkpoint
 
-ThreadPool *pool;
+IoExecutor *io; // I/O worker threads
+#define IO_WINDOW 4096  /* default max ops in flight (-o) */
+OpStats op_stats; // latency histograms and op counts of the I/O path
+ThroughputLog timeline; // ops/sec, MB/sec and queue depth over time (-l)
+char *stats_prefix = NULL; // -l: where timeline and histograms go
+double sample_interval = 1; // secs between timeline rows
+char *frag_out_file = NULL; // -g: memfs fragmentation dump
+StatsWriter stats_writer; // writes the dumps while aging goes on
+char *record_file = NULL; // --record: op trace written here
+char *replay_file = NULL; // --replay: op trace replayed, no model
+TraceWriter trace; // records the ops with --record
+char *track_file = NULL; // --track: changed block map written here
+ChangeMap *change_map = NULL; // blocks touched, with --track
+std::atomic<int> track_errno(0); // first FIEMAP failure, 0 if none
+boost::random::mt19937 victim_gen; // picks files to delete within a bucket
 
 uint64_t tick = 0;
 uint64_t global_live_file_count = 0;
@@ -96,5 +126,7 @@ size_t total_disk_capacity = 0;
 size_t live_data_size = 0;
 size_t workload_size = 0;
 
-enum AGING_TRIGGER {none, convergence, exec_time, workload, accuracy};
+enum AGING_TRIGGER {none, convergence, exec_time, workload, accuracy,
+  interrupted};
+volatile sig_atomic_t stop_requested = 0; // set by SIGINT
 
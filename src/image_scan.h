@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef IMAGE_SCAN_
+#define IMAGE_SCAN_
+/* one file found by ImageScanner */
+struct ScanEntry {
+  uint64_t age; // the file name, i.e. the tick it was created at
+  uint64_t size; // st_size
+  int32_t dir; // key the classify callback gave its directory
+};
+
+/*
+ * ImageScanner walks an already aged file system and collects the files
+ * geriatrix created there.  Directories are read with getdents64 in big
+ * chunks and handed out to a pool of threads through a shared stack, so
+ * every subtree is scanned in parallel.  Each directory's path (relative
+ * to the root, "" for the root itself) is passed to classify() once: a
+ * negative key means "not one of ours", otherwise every file in it whose
+ * name is a number becomes a ScanEntry carrying that key.  Everything
+ * else is only counted in `skipped'.
+ */
+class ImageScanner {
+  public:
+    typedef int (*classify_fn)(const std::string &rel_path);
+
+    std::vector<ScanEntry> entries;
+    uint64_t skipped; // files that do not look like ours
+    uint64_t dirs; // directories scanned
+
+    ImageScanner(const std::string &root, classify_fn classify) {
+      this->root = root;
+      this->classify = classify;
+      skipped = 0;
+      dirs = 0;
+      busy = 0;
+      error = 0;
+    }
+
+    /* scan with the given number of threads, 0 or -errno */
+    int run(int threads) {
+      std::vector<std::thread> workers;
+      todo.push_back("");
+      for(int i=0; i<std::max(threads, 1); i++) {
+        workers.emplace_back([this] { work(); });
+      }
+      for(auto &w : workers) {
+        w.join();
+      }
+      return error;
+    }
+
+  private:
+    struct linux_dirent64 {
+      uint64_t d_ino;
+      int64_t d_off;
+      unsigned short d_reclen;
+      unsigned char d_type;
+      char d_name[];
+    };
+
+    std::string root;
+    classify_fn classify;
+    std::vector<std::string> todo; // directories still to scan
+    int busy; // threads scanning a directory
+    int error;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    void work() {
+      std::vector<ScanEntry> found;
+      std::vector<std::string> subdirs;
+      uint64_t others = 0, scanned = 0;
+      std::unique_lock<std::mutex> lock(mutex);
+      while(1) {
+        cond.wait(lock, [this] { return !todo.empty() || (busy == 0); });
+        if(todo.empty() || error) {
+          break;
+        }
+        auto rel = todo.back();
+        todo.pop_back();
+        busy++;
+        lock.unlock();
+
+        int rv = scanDir(rel, found, subdirs, others);
+        scanned++;
+
+        lock.lock();
+        busy--;
+        if(rv < 0) {
+          error = rv;
+        }
+        for(auto &d : subdirs) {
+          todo.push_back(d);
+        }
+        subdirs.clear();
+        cond.notify_all();
+      }
+      entries.insert(entries.end(), found.begin(), found.end());
+      skipped += others;
+      dirs += scanned;
+    }
+
+    int scanDir(const std::string &rel, std::vector<ScanEntry> &found,
+        std::vector<std::string> &subdirs, uint64_t &others) {
+      auto path = rel.empty() ? root : root + "/" + rel;
+      int fd = open(path.c_str(), O_RDONLY|O_DIRECTORY);
+      if(fd < 0) {
+        return -errno;
+      }
+      int key = classify(rel);
+      char buf[65536];
+      while(1) {
+        auto n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if(n < 0) {
+          int rv = -errno;
+          close(fd);
+          return rv;
+        }
+        if(n == 0) {
+          break;
+        }
+        for(long off = 0; off < n; ) {
+          auto de = (struct linux_dirent64 *) (buf + off);
+          off += de->d_reclen;
+          auto name = de->d_name;
+          if((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0)) {
+            continue;
+          }
+          auto type = de->d_type;
+          struct stat st;
+          bool have_stat = false;
+          if(type == DT_UNKNOWN) {
+            if(fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+              continue; // raced with something removing it
+            }
+            have_stat = true;
+            type = S_ISDIR(st.st_mode) ? DT_DIR :
+              (S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN);
+          }
+          if(type == DT_DIR) {
+            subdirs.push_back(rel.empty() ? name : rel + "/" + name);
+            continue;
+          }
+          char *end = NULL;
+          uint64_t age = strtoull(name, &end, 10);
+          if((type != DT_REG) || (key < 0) || (*name < '0') ||
+              (*name > '9') || (*end != '\0')) {
+            others++;
+            continue;
+          }
+          if(!have_stat &&
+              (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)) {
+            continue;
+          }
+          ScanEntry e;
+          e.age = age;
+          e.size = st.st_size;
+          e.dir = key;
+          found.push_back(e);
+        }
+      }
+      close(fd);
+      return 0;
+    }
+};
+#endif  /* IMAGE_SCAN_ */
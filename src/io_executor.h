@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef IO_EXECUTOR_
+#define IO_EXECUTOR_
+/*
+ * IoOp is one aging operation handed to the I/O workers.  The path is
+ * not stored: it is rebuilt by the worker from the dir bucket id, the
+ * sibling dir and the age (file name), none of which change once the
+ * model is set up, so an op is a small plain struct.
+ */
+struct IoOp {
+  enum type_t : uint8_t { CREATE = 1, DELETE };
+
+  uint64_t age; // file name
+  uint64_t len; // bytes to allocate (CREATE only)
+  uint32_t subdir; // sibling dir, 0 for none (replay: trace dir index)
+  uint16_t dir_id; // DirBucket the file lives in
+  type_t type;
+};
+
+/*
+ * IoWindowStats tells whether a run is limited by the planner or by the
+ * device: the mean number of ops in flight when the planner submits, and
+ * how long the planner sat waiting for the in-flight window to open up.
+ * Only the submitting thread updates it.
+ */
+struct IoWindowStats {
+  uint64_t ops; // ops submitted
+  uint64_t depth_sum; // sum of ops in flight seen at each submit
+  uint64_t stalls; // submits that had to wait for the window
+  uint64_t stall_ns; // total time spent waiting
+  std::chrono::steady_clock::time_point start;
+
+  IoWindowStats() {
+    ops = depth_sum = stalls = stall_ns = 0;
+    start = std::chrono::steady_clock::now();
+  }
+
+  void record(size_t depth) {
+    ops++;
+    depth_sum += depth;
+  }
+
+  double meanDepth() const {
+    return ops ? (double) depth_sum / ops : 0.0;
+  }
+
+  /* fraction of the wall clock time the planner spent stalled */
+  double stallFraction() const {
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    return elapsed > 0 ? (double) stall_ns / elapsed : 0.0;
+  }
+};
+
+/*
+ * OpRing is a bounded lock-free queue of IoOps (Vyukov's bounded queue:
+ * every cell carries a sequence number telling producers and consumers
+ * whose turn it is), so queueing an op is a couple of atomics and a copy
+ * rather than an allocation and a lock.
+ */
+class OpRing {
+  public:
+    OpRing() {
+      ring = NULL;
+      mask = 0;
+    }
+
+    ~OpRing() {
+      delete [] ring;
+    }
+
+    void init(size_t capacity) {
+      assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+      ring = new Cell[capacity];
+      mask = capacity - 1;
+      for(size_t i=0; i<capacity; i++) {
+        ring[i].seq.store(i, std::memory_order_relaxed);
+      }
+      head.store(0, std::memory_order_relaxed);
+      tail.store(0, std::memory_order_relaxed);
+    }
+
+    bool push(const IoOp &op) {
+      auto pos = tail.load(std::memory_order_relaxed);
+      Cell *c;
+      while(1) {
+        c = &ring[pos & mask];
+        auto seq = c->seq.load(std::memory_order_acquire);
+        auto dif = (intptr_t) seq - (intptr_t) pos;
+        if(dif == 0) {
+          if(tail.compare_exchange_weak(pos, pos + 1,
+                std::memory_order_relaxed)) {
+            break;
+          }
+        } else if(dif < 0) {
+          return false; // full
+        } else {
+          pos = tail.load(std::memory_order_relaxed);
+        }
+      }
+      c->op = op;
+      c->seq.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool pop(IoOp &op) {
+      auto pos = head.load(std::memory_order_relaxed);
+      Cell *c;
+      while(1) {
+        c = &ring[pos & mask];
+        auto seq = c->seq.load(std::memory_order_acquire);
+        auto dif = (intptr_t) seq - (intptr_t) (pos + 1);
+        if(dif == 0) {
+          if(head.compare_exchange_weak(pos, pos + 1,
+                std::memory_order_relaxed)) {
+            break;
+          }
+        } else if(dif < 0) {
+          return false; // empty
+        } else {
+          pos = head.load(std::memory_order_relaxed);
+        }
+      }
+      op = c->op;
+      c->seq.store(pos + mask + 1, std::memory_order_release);
+      return true;
+    }
+
+    /* ops pushed (or being pushed) but not yet popped */
+    bool empty() const {
+      return head.load() == tail.load();
+    }
+
+  private:
+    struct Cell {
+      std::atomic<size_t> seq;
+      IoOp op;
+    };
+
+    Cell *ring;
+    size_t mask;
+    char pad0[64];
+    std::atomic<size_t> tail; // next cell to fill
+    char pad1[64];
+    std::atomic<size_t> head; // next cell to drain
+    char pad2[64];
+};
+
+/*
+ * IoExecutor runs IoOps on a fixed set of worker threads, fire and
+ * forget.  Every worker has its own OpRing and an op always goes to the
+ * worker its file name hashes to, so all ops on one path run on one
+ * thread in the order they were submitted: a file is never unlinked
+ * before it has been created.  The directories are all made before aging
+ * starts and never removed, so there are no other dependencies between
+ * ops and the resulting namespace is the same as a serial run's, at any
+ * number of workers.
+ *
+ * At most `window' ops are in flight (queued or running) at any time.
+ * A submitter that hits the window yields for a while and then sleeps
+ * until the workers have retired an eighth of it, so the planner can
+ * never run more than one window ahead of the disk.  Workers pop ops in
+ * batches and spin for a while on an empty ring (multi-core hosts only)
+ * before going to sleep on their condvar; submitters only touch the
+ * condvar when that worker is asleep.
+ *
+ * With no workers ops are dropped, i.e. -t 0 still performs no I/O.
+ * The destructor runs every op still queued before returning.
+ */
+class IoExecutor {
+  public:
+    typedef void (*run_fn)(const IoOp &op);
+
+    static const int BATCH = 32; // ops a worker pops at once
+    static const int SPIN = 1000; // empty polls before a worker sleeps
+
+    IoExecutor(size_t threads, size_t window, run_fn run) {
+      assert(window > 0);
+      this->window = window;
+      /* let a stalled submitter refill 1/8th of the window at a time */
+      low_water = window - std::max((size_t) 1, window / 8);
+      size_t capacity = 2;
+      while(capacity < window) {
+        capacity <<= 1;
+      }
+      nworkers = threads;
+      queues = new Queue[threads];
+      for(size_t i=0; i<threads; i++) {
+        queues[i].ring.init(capacity);
+        queues[i].sleeping.store(0);
+      }
+      pending.store(0);
+      waiters.store(0);
+      stop = false;
+      this->run = run;
+      /* spinning only pays off if the submitter has a core of its own */
+      spin = (std::thread::hardware_concurrency() > 1) ? SPIN : 0;
+      for(size_t i=0; i<threads; i++) {
+        workers.emplace_back([this, i] { work(queues[i]); });
+      }
+    }
+
+    ~IoExecutor() {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        stop = true;
+      }
+      for(size_t i=0; i<nworkers; i++) {
+        queues[i].cond.notify_all();
+      }
+      for(auto &w : workers) {
+        w.join();
+      }
+      delete [] queues;
+    }
+
+    void submit(const IoOp &op) {
+      submit(op, op.age);
+    }
+
+    /*
+     * queue op on the worker `shard' hashes to instead of its file's.
+     * Only safe for ops that nothing else queued can race with, e.g. the
+     * creates of a bulk fill followed by a drain().
+     */
+    void submit(const IoOp &op, uint64_t shard) {
+      if(nworkers == 0) {
+        return;
+      }
+      auto depth = pending.load();
+      if(depth >= window) {
+        waitForWindow();
+        depth = pending.load();
+      }
+      stats.record(depth);
+      pending++;
+      auto &q = queues[shard % nworkers];
+      while(!q.ring.push(op)) {
+        std::this_thread::yield(); // ring full, let the worker catch up
+      }
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(q.sleeping.load() > 0) {
+        std::unique_lock<std::mutex> lock(mutex);
+        q.cond.notify_one();
+      }
+    }
+
+    /* wait until every op submitted so far has completed */
+    void drain() {
+      if(pending.load() == 0) {
+        return;
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      waiters++;
+      room.wait(lock, [this] { return pending.load() == 0; });
+      waiters--;
+    }
+
+    /* ops submitted and not yet completed */
+    size_t inflight() const {
+      return pending.load(std::memory_order_relaxed);
+    }
+
+    size_t windowSize() const {
+      return window;
+    }
+
+    const IoWindowStats& windowStats() const {
+      return stats;
+    }
+
+  private:
+    struct Queue {
+      OpRing ring;
+      std::atomic<int> sleeping; // the worker is waiting on cond
+      std::condition_variable cond;
+    };
+
+    Queue *queues;
+    size_t nworkers;
+    std::atomic<size_t> pending; // ops in flight
+    std::atomic<int> waiters; // submitters waiting for the window
+    size_t window;
+    size_t low_water; // a stalled submitter resumes at this depth
+    IoWindowStats stats;
+    std::mutex mutex;
+    std::condition_variable room; // submitters wait here for the window
+    bool stop;
+    int spin;
+    run_fn run;
+    std::vector<std::thread> workers;
+
+    void waitForWindow() {
+      auto t0 = std::chrono::steady_clock::now();
+      for(int i=0; (i < spin) && (pending.load() >= window); i++) {
+        std::this_thread::yield();
+      }
+      if(pending.load() >= window) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiters++;
+        room.wait(lock, [this] { return pending.load() <= low_water; });
+        waiters--;
+      }
+      stats.stalls++;
+      stats.stall_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - t0).count();
+    }
+
+    void work(Queue &q) {
+      IoOp batch[BATCH];
+      int idle = 0;
+      while(1) {
+        int n = 0;
+        while((n < BATCH) && q.ring.pop(batch[n])) {
+          n++;
+        }
+        for(int i=0; i<n; i++) {
+          run(batch[i]);
+          if((--pending <= low_water) && (waiters.load() > 0)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            room.notify_one();
+          }
+        }
+        if(n > 0) {
+          idle = 0;
+          continue;
+        }
+        if(++idle < spin) {
+          std::this_thread::yield();
+          continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        q.sleeping++;
+        q.cond.wait(lock, [this, &q] { return stop || !q.ring.empty(); });
+        q.sleeping--;
+        if(stop && q.ring.empty()) {
+          return;
+        }
+        idle = 0;
+      }
+    }
+};
+#endif  /* IO_EXECUTOR_ */
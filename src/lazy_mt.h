@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+
+#ifndef LAZY_MT_
+#define LAZY_MT_
+/*
+ * LazyMt19937 produces the same numbers as a freshly seeded
+ * boost::random::mt19937, but only for its first few draws.  A full
+ * engine seeds all 624 words of state and then regenerates all of them
+ * before the first draw; draw i only depends on words i, i+1 and i+397,
+ * so we seed just as far as needed and never twist the rest.  That makes
+ * a throw-away generator per sibling dir pick about 3x cheaper.
+ */
+class LazyMt19937 {
+  public:
+    typedef uint32_t result_type;
+
+    static const int N = 624;
+    static const int M = 397;
+    static const int MAX_DRAWS = N - M; // before a real twist is needed
+
+    explicit LazyMt19937(uint32_t seed) {
+      x[0] = seed;
+      seeded = 1;
+      i = 0;
+    }
+
+    static result_type min() {
+      return 0;
+    }
+
+    static result_type max() {
+      return 0xffffffff;
+    }
+
+    result_type operator()() {
+      assert(i < MAX_DRAWS);
+      while(seeded <= i + M) {
+        auto p = x[seeded - 1];
+        x[seeded] = 1812433253U * (p ^ (p >> 30)) + seeded;
+        seeded++;
+      }
+      uint32_t y = (x[i] & 0x80000000U) | (x[i+1] & 0x7fffffffU);
+      uint32_t z = x[i+M] ^ (y >> 1) ^ ((x[i+1] & 1) ? 0x9908b0dfU : 0);
+      i++;
+      z ^= (z >> 11);
+      z ^= (z << 7) & 0x9d2c5680U;
+      z ^= (z << 15) & 0xefc60000U;
+      z ^= (z >> 18);
+      return z;
+    }
+
+  private:
+    uint32_t x[N];
+    int seeded; // words of x seeded so far
+    int i; // draws so far
+};
+#endif  /* LAZY_MT_ */
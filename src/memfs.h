@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+#include "block_alloc.h"
+
+#ifndef MEMFS_
+#define MEMFS_
+/*
+ * MemFs is an in-process file system behind -b memfs: a namespace of
+ * files and directories and a BlockAllocator handing out the blocks of a
+ * simulated device, and no data.  It lets the whole I/O pipeline (I/O
+ * workers, mkdir_path, the backend calls) run at memory speed, e.g. to
+ * benchmark the planner, while still failing like a file system does:
+ * ENOENT for a missing file or parent, EEXIST for a name taken, EISDIR
+ * and so on.  Every call is thread-safe.
+ *
+ * The one exception is ENOSPC.  Geriatrix budgets the disk by nominal
+ * file sizes and stable aging runs it nearly full, so rounding files up
+ * to whole blocks, a create overtaking a delete on another worker, or the
+ * last file of the rapid fill, can need more than the device has.  A real
+ * disk answers ENOSPC and the create waits for space, which stalls or even
+ * deadlocks the workers; a MemFs device grows by what is missing instead
+ * and reports by how much, so a benchmark run always completes.
+ *
+ * The namespace is split into shards by path hash, each with its own
+ * lock, so workers creating files in different directories rarely meet.
+ * Inode state (extents, open count) and the allocator share one lock.
+ * Paths are taken as given, "//" and trailing '/' aside: there is no cwd,
+ * "." or "..", and a path without a leading '/' is relative to a root of
+ * its own.
+ *
+ * As files come and go MemFs keeps fragmentation metrics current: the
+ * allocator's free run histogram, how many files have how many extents,
+ * and the layout score (the fraction of file blocks that directly follow
+ * the file's previous block, 1.0 meaning every file is contiguous).
+ */
+class MemFs {
+  public:
+    static const uint64_t BLOCK = 4096;
+    static const int MAX_EXTENTS = 64; // files with more share a bucket
+
+    /* a device of alloc->blocks() blocks, MemFs takes alloc over */
+    MemFs(BlockAllocator *alloc) {
+      this->alloc = alloc;
+      device_blocks = alloc->blocks();
+      nfiles = ndirs = nextents = grown = 0;
+      next_blocks = follow_blocks = 0;
+      std::fill(extent_hist, extent_hist + MAX_EXTENTS + 1, 0);
+    }
+
+    ~MemFs() {
+      for(auto &s : shards) {
+        for(auto &e : s.names) {
+          delete e.second;
+        }
+      }
+      for(auto n : fds) {
+        if(n && n->unlinked) {
+          release(n); // unlinked but left open
+        }
+      }
+      delete alloc;
+    }
+
+    int open(const char *path, int flags, mode_t mode) {
+      auto p = normalize(path);
+      if(!parentIsDir(p)) {
+        errno = ENOENT;
+        return -1;
+      }
+      Node *n;
+      {
+        auto &s = shard(p);
+        std::lock_guard<std::mutex> lock(s.lock);
+        auto it = s.names.find(p);
+        if(it != s.names.end()) {
+          n = it->second;
+          if((flags & O_CREAT) && (flags & O_EXCL)) {
+            errno = EEXIST;
+            return -1;
+          }
+          if(n->dir && ((flags & O_ACCMODE) != O_RDONLY)) {
+            errno = EISDIR;
+            return -1;
+          }
+        } else if(flags & O_CREAT) {
+          n = new Node(false, mode);
+          n->dir_key = std::hash<std::string>()(parent(p));
+          s.names[p] = n;
+          std::lock_guard<std::mutex> ilock(inode_lock);
+          nfiles++;
+        } else {
+          errno = ENOENT;
+          return -1;
+        }
+        std::lock_guard<std::mutex> ilock(inode_lock);
+        n->opens++;
+      }
+      std::lock_guard<std::mutex> lock(fd_lock);
+      int fd;
+      if(free_fds.empty()) {
+        fd = fds.size();
+        fds.push_back(n);
+      } else {
+        fd = free_fds.back();
+        free_fds.pop_back();
+        fds[fd] = n;
+      }
+      return fd;
+    }
+
+    int close(int fd) {
+      Node *n = takeFd(fd);
+      if(n == NULL) {
+        errno = EBADF;
+        return -1;
+      }
+      std::lock_guard<std::mutex> lock(inode_lock);
+      n->opens--;
+      if(n->unlinked && (n->opens == 0)) {
+        release(n);
+      }
+      return 0;
+    }
+
+    /* nothing is stored, but the file grows and gets blocks like a write */
+    ssize_t write(int fd, const void *buf, size_t nbytes) {
+      (void) buf;
+      Node *n = getFd(fd);
+      if(n == NULL) {
+        errno = EBADF;
+        return -1;
+      }
+      if(n->dir) {
+        errno = EISDIR;
+        return -1;
+      }
+      std::lock_guard<std::mutex> lock(inode_lock);
+      uint64_t end = n->size + nbytes;
+      allocate(n, end);
+      n->size = end;
+      return nbytes;
+    }
+
+    /* posix_fallocate() semantics: 0 or an error number, errno untouched */
+    int fallocate(int fd, off_t offset, off_t len) {
+      if((offset < 0) || (len <= 0)) {
+        return EINVAL;
+      }
+      Node *n = getFd(fd);
+      if(n == NULL) {
+        return EBADF;
+      }
+      if(n->dir) {
+        return ENODEV;
+      }
+      std::lock_guard<std::mutex> lock(inode_lock);
+      uint64_t end = offset + len;
+      allocate(n, end);
+      n->size = std::max(n->size, end);
+      return 0;
+    }
+
+    int access(const char *path, int mode) {
+      (void) mode; // no permission checks
+      struct stat st;
+      return stat(path, &st);
+    }
+
+    int unlink(const char *path) {
+      auto p = normalize(path);
+      Node *n;
+      {
+        auto &s = shard(p);
+        std::lock_guard<std::mutex> lock(s.lock);
+        auto it = s.names.find(p);
+        if(it == s.names.end()) {
+          errno = ENOENT;
+          return -1;
+        }
+        n = it->second;
+        if(n->dir) {
+          errno = EISDIR;
+          return -1;
+        }
+        s.names.erase(it);
+      }
+      std::lock_guard<std::mutex> lock(inode_lock);
+      nfiles--;
+      n->unlinked = true;
+      if(n->opens == 0) {
+        release(n);
+      }
+      return 0;
+    }
+
+    int mkdir(const char *path, mode_t mode) {
+      auto p = normalize(path);
+      if(isRoot(p)) {
+        errno = EEXIST;
+        return -1;
+      }
+      if(!parentIsDir(p)) {
+        errno = ENOENT;
+        return -1;
+      }
+      auto &s = shard(p);
+      std::lock_guard<std::mutex> lock(s.lock);
+      if(s.names.count(p) > 0) {
+        errno = EEXIST;
+        return -1;
+      }
+      s.names[p] = new Node(true, mode);
+      std::lock_guard<std::mutex> ilock(inode_lock);
+      ndirs++;
+      return 0;
+    }
+
+    int stat(const char *path, struct stat *st) {
+      auto p = normalize(path);
+      memset(st, 0, sizeof(*st));
+      st->st_blksize = BLOCK;
+      st->st_nlink = 1;
+      if(isRoot(p)) {
+        st->st_mode = S_IFDIR | 0755;
+        return 0;
+      }
+      auto &s = shard(p);
+      std::lock_guard<std::mutex> lock(s.lock);
+      auto it = s.names.find(p);
+      if(it == s.names.end()) {
+        errno = ENOENT;
+        return -1;
+      }
+      auto n = it->second;
+      std::lock_guard<std::mutex> ilock(inode_lock);
+      st->st_mode = (n->dir ? S_IFDIR : S_IFREG) | (n->mode & 07777);
+      st->st_size = n->size;
+      st->st_blocks = n->blocks * (BLOCK / 512);
+      return 0;
+    }
+
+    int chmod(const char *path, mode_t mode) {
+      auto p = normalize(path);
+      if(isRoot(p)) {
+        return 0;
+      }
+      auto &s = shard(p);
+      std::lock_guard<std::mutex> lock(s.lock);
+      auto it = s.names.find(p);
+      if(it == s.names.end()) {
+        errno = ENOENT;
+        return -1;
+      }
+      it->second->mode = mode;
+      return 0;
+    }
+
+    /* a consistent snapshot of how the device is used */
+    struct Usage {
+      uint64_t files, dirs;
+      uint64_t blocks, free_blocks; // device size and free space in blocks
+      uint64_t device_blocks; // size it was created with
+      uint64_t file_extents; // extents held by files
+      uint64_t free_extents; // runs of free blocks
+      uint64_t grown; // allocations that had to grow the device
+      double layout_score;
+      // free runs of [2^i, 2^(i+1)) blocks
+      uint64_t free_hist[BlockAllocator::CLASSES];
+      // files with i extents, the last bucket has those with more
+      uint64_t extent_hist[MAX_EXTENTS + 1];
+    };
+
+    Usage usage() {
+      std::lock_guard<std::mutex> lock(inode_lock);
+      Usage u;
+      u.files = nfiles;
+      u.dirs = ndirs;
+      u.blocks = alloc->blocks();
+      u.free_blocks = alloc->freeBlocks();
+      u.file_extents = nextents;
+      u.free_extents = alloc->freeRuns();
+      u.device_blocks = device_blocks;
+      u.grown = grown;
+      u.layout_score = next_blocks ? (double) follow_blocks / next_blocks : 1;
+      for(int i=0; i<BlockAllocator::CLASSES; i++) {
+        u.free_hist[i] = alloc->freeRuns(i);
+      }
+      std::copy(extent_hist, extent_hist + MAX_EXTENTS + 1, u.extent_hist);
+      return u;
+    }
+
+  private:
+    struct Node {
+      bool dir;
+      bool unlinked; // name gone, freed on last close
+      mode_t mode;
+      int opens;
+      uint64_t size; // bytes
+      uint64_t blocks; // allocated
+      uint64_t dir_key; // hash of the parent directory's path
+      std::vector<Extent> extents;
+
+      Node(bool dir, mode_t mode) {
+        this->dir = dir;
+        this->mode = mode;
+        unlinked = false;
+        opens = 0;
+        size = blocks = dir_key = 0;
+      }
+    };
+
+    struct Shard {
+      std::mutex lock;
+      boost::unordered_map<std::string, Node*> names;
+    };
+
+    static const int NSHARDS = 64;
+
+    Shard shards[NSHARDS];
+    std::mutex fd_lock;
+    std::vector<Node*> fds; // open files by fd
+    std::vector<int> free_fds;
+
+    std::mutex inode_lock; // Node contents and everything below
+    BlockAllocator *alloc;
+    uint64_t device_blocks;
+    uint64_t nfiles, ndirs, nextents;
+    uint64_t grown;
+    uint64_t extent_hist[MAX_EXTENTS + 1]; // files by number of extents
+    // layout score: blocks that could follow their file's previous block
+    // and blocks that do
+    uint64_t next_blocks, follow_blocks;
+
+    static std::string normalize(const char *path) {
+      std::string p;
+      p.reserve(strlen(path));
+      for(auto c = path; *c; c++) {
+        if((*c == '/') && !p.empty() && (p.back() == '/')) {
+          continue;
+        }
+        p.push_back(*c);
+      }
+      if((p.size() > 1) && (p.back() == '/')) {
+        p.pop_back();
+      }
+      return p;
+    }
+
+    static bool isRoot(const std::string &p) {
+      return p.empty() || (p == "/");
+    }
+
+    Shard& shard(const std::string &p) {
+      return shards[std::hash<std::string>()(p) % NSHARDS];
+    }
+
+    /* "" for the root */
+    static std::string parent(const std::string &p) {
+      auto slash = p.rfind('/');
+      if((slash == std::string::npos) || (slash == 0)) {
+        return "";
+      }
+      return p.substr(0, slash);
+    }
+
+    bool parentIsDir(const std::string &p) {
+      auto dir = parent(p);
+      if(dir.empty()) {
+        return true;
+      }
+      auto &s = shard(dir);
+      std::lock_guard<std::mutex> lock(s.lock);
+      auto it = s.names.find(dir);
+      return (it != s.names.end()) && it->second->dir;
+    }
+
+    Node* getFd(int fd) {
+      std::lock_guard<std::mutex> lock(fd_lock);
+      if((fd < 0) || (fd >= (int) fds.size())) {
+        return NULL;
+      }
+      return fds[fd];
+    }
+
+    Node* takeFd(int fd) {
+      std::lock_guard<std::mutex> lock(fd_lock);
+      if((fd < 0) || (fd >= (int) fds.size()) || (fds[fd] == NULL)) {
+        return NULL;
+      }
+      auto n = fds[fd];
+      fds[fd] = NULL;
+      free_fds.push_back(fd);
+      return n;
+    }
+
+    /*
+     * give n blocks up to byte `end'.  A new file starts where the
+     * allocator wants its directory's files, more blocks for a file are
+     * asked for right after its last one.  If there are not enough free
+     * blocks the device is grown.  Called with inode_lock held.
+     */
+    void allocate(Node *n, uint64_t end) {
+      uint64_t want = (end + BLOCK - 1) / BLOCK;
+      if(want <= n->blocks) {
+        return;
+      }
+      want -= n->blocks;
+      if(want > alloc->freeBlocks()) {
+        alloc->grow(want - alloc->freeBlocks());
+        grown++;
+      }
+      account(n, -1);
+      while(want > 0) {
+        uint64_t goal = alloc->dirGoal(n->dir_key);
+        if(!n->extents.empty()) {
+          auto &last = n->extents.back();
+          goal = last.start + last.len;
+        }
+        auto e = alloc->alloc(want, goal);
+        assert(e.len > 0);
+        if(!n->extents.empty() &&
+            (n->extents.back().start + n->extents.back().len == e.start)) {
+          n->extents.back().len += e.len;
+        } else {
+          n->extents.push_back(e);
+          nextents++;
+        }
+        n->blocks += e.len;
+        want -= e.len;
+      }
+      account(n, 1);
+    }
+
+    /* add (sign 1) or remove (-1) n from the fragmentation metrics */
+    void account(Node *n, int sign) {
+      if(n->extents.empty()) {
+        return;
+      }
+      extent_hist[std::min(n->extents.size(), (size_t) MAX_EXTENTS)] += sign;
+      next_blocks += sign * (int64_t) (n->blocks - 1);
+      follow_blocks += sign * (int64_t) (n->blocks - n->extents.size());
+    }
+
+    /* free an unlinked, closed file.  Called with inode_lock held. */
+    void release(Node *n) {
+      account(n, -1);
+      for(auto &e : n->extents) {
+        alloc->free(e);
+      }
+      nextents -= n->extents.size();
+      delete n;
+    }
+};
+#endif  /* MEMFS_ */
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+#ifndef OP_STATS_
+#define OP_STATS_
+/* monotonic clock in ns, cheap enough to call around every syscall */
+static inline uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * LatencyHistogram is an HDR-style histogram of latencies in ns: values
+ * below 2^SUB_BITS get a bucket each, larger ones are bucketed by their
+ * top SUB_BITS bits, so a bucket never spans more than 1/16th of the
+ * values in it whatever the magnitude.  Buckets are relaxed atomics so
+ * every I/O worker records into the same histogram.
+ */
+class LatencyHistogram {
+  public:
+    static const int SUB_BITS = 5;
+    static const int SUB = 1 << SUB_BITS;
+    static const int HALF = SUB / 2;
+    static const int NBUCKETS = (64 - SUB_BITS + 2) * HALF;
+
+    LatencyHistogram() {
+      for(int i=0; i<NBUCKETS; i++) {
+        counts[i].store(0, std::memory_order_relaxed);
+      }
+      total.store(0, std::memory_order_relaxed);
+      sum.store(0, std::memory_order_relaxed);
+      max_ns.store(0, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t ns) {
+      counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+      total.fetch_add(1, std::memory_order_relaxed);
+      sum.fetch_add(ns, std::memory_order_relaxed);
+      auto m = max_ns.load(std::memory_order_relaxed);
+      while((ns > m) && !max_ns.compare_exchange_weak(m, ns,
+            std::memory_order_relaxed)) {
+      }
+    }
+
+    uint64_t count() const {
+      return total.load(std::memory_order_relaxed);
+    }
+
+    double mean() const {
+      auto n = count();
+      return n ? (double) sum.load(std::memory_order_relaxed) / n : 0.0;
+    }
+
+    uint64_t max() const {
+      return max_ns.load(std::memory_order_relaxed);
+    }
+
+    /* smallest bucket bound at or below which a fraction p of values are */
+    uint64_t percentile(double p) const {
+      auto n = count();
+      if(n == 0) {
+        return 0;
+      }
+      uint64_t want = std::max((uint64_t) 1, (uint64_t) (p * n + 0.5));
+      uint64_t seen = 0;
+      for(int i=0; i<NBUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if(seen >= want) {
+          return std::min(high(i), max());
+        }
+      }
+      return max();
+    }
+
+    /* "low_ns,high_ns,count" for every non-empty bucket */
+    void dump(FILE *fp, const char *name) const {
+      for(int i=0; i<NBUCKETS; i++) {
+        auto c = counts[i].load(std::memory_order_relaxed);
+        if(c > 0) {
+          fprintf(fp, "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", name,
+              low(i), high(i), c);
+        }
+      }
+    }
+
+  private:
+    std::atomic<uint64_t> counts[NBUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max_ns;
+
+    static int bucket(uint64_t v) {
+      if(v < (uint64_t) SUB) {
+        return v;
+      }
+      int e = 63 - __builtin_clzll(v) - SUB_BITS + 1;
+      return e * HALF + (int) (v >> e);
+    }
+
+    static uint64_t low(int i) {
+      if(i < SUB) {
+        return i;
+      }
+      int e = i / HALF - 1;
+      return (uint64_t) (i - e * HALF) << e;
+    }
+
+    static uint64_t high(int i) {
+      if(i < SUB) {
+        return i;
+      }
+      int e = i / HALF - 1;
+      return (((uint64_t) (i - e * HALF + 1)) << e) - 1;
+    }
+};
+
+/*
+ * OpStats collects what the I/O path does: a latency histogram per
+ * backend call and running totals of completed aging ops and of the
+ * bytes they allocated, which ThroughputLog samples.
+ */
+class OpStats {
+  public:
+    enum call_t { OPEN = 0, FALLOCATE, CLOSE, UNLINK, NUM_CALLS };
+
+    LatencyHistogram latency[NUM_CALLS];
+    std::atomic<uint64_t> ops; // creates and deletes completed
+    std::atomic<uint64_t> bytes; // bytes allocated by completed creates
+
+    OpStats() {
+      ops.store(0);
+      bytes.store(0);
+    }
+
+    static const char* name(int call) {
+      static const char *names[NUM_CALLS] = {
+        "open", "fallocate", "close", "unlink"
+      };
+      return names[call];
+    }
+
+    void opDone(uint64_t len) {
+      ops.fetch_add(1, std::memory_order_relaxed);
+      if(len > 0) {
+        bytes.fetch_add(len, std::memory_order_relaxed);
+      }
+    }
+
+    /* one line per call that was made, latencies in us */
+    void print(std::ostream &out) const {
+      for(int i=0; i<NUM_CALLS; i++) {
+        auto &h = latency[i];
+        if(h.count() == 0) {
+          continue;
+        }
+        char line[256];
+        snprintf(line, sizeof(line), " %-9s latency (us): n = %" PRIu64
+            ", mean = %.1f, p50 = %.1f, p99 = %.1f, p99.9 = %.1f, "
+            "max = %.1f", name(i), h.count(), h.mean() / 1000,
+            h.percentile(0.5) / 1000.0, h.percentile(0.99) / 1000.0,
+            h.percentile(0.999) / 1000.0, h.max() / 1000.0);
+        out << line << std::endl;
+      }
+    }
+
+    int dump(const char *path) const {
+      FILE *fp = fopen(path, "w");
+      if(fp == NULL) {
+        return -1;
+      }
+      fprintf(fp, "call,low_ns,high_ns,count\n");
+      for(int i=0; i<NUM_CALLS; i++) {
+        latency[i].dump(fp, name(i));
+      }
+      return fclose(fp);
+    }
+};
+
+/*
+ * ThroughputLog appends one CSV row per interval from a thread of its
+ * own: seconds since start, ops/sec and MB/sec completed during the
+ * interval, the number of ops in flight at the end of it and the running
+ * totals.  A file system slowing down as it ages shows up as falling
+ * rates at the same queue depth.
+ */
+class ThroughputLog {
+  public:
+    typedef size_t (*depth_fn)();
+
+    ThroughputLog() {
+      fp = NULL;
+      stopping = false;
+    }
+
+    ~ThroughputLog() {
+      stop();
+    }
+
+    int start(const char *path, double interval, const OpStats *stats,
+        depth_fn depth) {
+      fp = fopen(path, "w");
+      if(fp == NULL) {
+        return -1;
+      }
+      fprintf(fp, "secs,ops_per_sec,mb_per_sec,in_flight,ops,mb\n");
+      this->interval = interval;
+      this->stats = stats;
+      this->depth = depth;
+      t0 = std::chrono::steady_clock::now();
+      last = t0;
+      last_ops = stats->ops.load();
+      last_bytes = stats->bytes.load();
+      sampler = std::thread([this] { run(); });
+      return 0;
+    }
+
+    /* write a last row covering the time since the previous one */
+    void stop() {
+      if(fp == NULL) {
+        return;
+      }
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      cond.notify_one();
+      sampler.join();
+      sample();
+      fclose(fp);
+      fp = NULL;
+    }
+
+  private:
+    FILE *fp;
+    double interval; // seconds
+    const OpStats *stats;
+    depth_fn depth;
+    std::chrono::steady_clock::time_point t0, last;
+    uint64_t last_ops, last_bytes;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread sampler;
+
+    void run() {
+      auto period = std::chrono::duration_cast<
+        std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(interval));
+      auto next = t0 + period;
+      std::unique_lock<std::mutex> lock(mutex);
+      while(!cond.wait_until(lock, next, [this] { return stopping; })) {
+        sample();
+        next += period;
+      }
+    }
+
+    void sample() {
+      auto now = std::chrono::steady_clock::now();
+      auto ops = stats->ops.load();
+      auto bytes = stats->bytes.load();
+      double secs = std::chrono::duration<double>(now - last).count();
+      if(secs <= 0) {
+        return;
+      }
+      fprintf(fp, "%.3f,%.1f,%.3f,%zu,%" PRIu64 ",%.3f\n",
+          std::chrono::duration<double>(now - t0).count(),
+          (ops - last_ops) / secs, (bytes - last_bytes) / secs / 1048576,
+          depth(), ops, bytes / 1048576.0);
+      fflush(fp);
+      last = now;
+      last_ops = ops;
+      last_bytes = bytes;
+    }
+};
+#endif  /* OP_STATS_ */
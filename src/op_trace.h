@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+#ifndef OP_TRACE_
+#define OP_TRACE_
+/*
+ * An op trace is every create and delete of an aging run, in the order
+ * the planner issued them, with nothing of the model needed to replay it.
+ * After an 8 byte magic it is a stream of records, all integers unsigned
+ * LEB128 varints, each record starting with
+ *
+ *   head = (tick - previous record's tick) << 2 | kind
+ *
+ * and the rest depending on kind:
+ *
+ *   CREATE  dir, size, tick - age   file `age' in dir, allocate size
+ *   DELETE  dir, tick - age
+ *   DEFINE  0, k, n, n bytes        the next dir: the first k bytes of
+ *                                   the previous dir and n more (a path
+ *                                   relative to the mount point, "" for
+ *                                   the root)
+ *           1, bytes                the next size
+ *   DRAIN                           wait for every op so far to complete
+ *
+ * dir and size index the dirs and sizes DEFINEd so far, which are
+ * written the first time they are used.  A trace of an aging run starts
+ * with a DEFINE of every dir of the tree, parents first, and a DRAIN, so
+ * a replay makes the same namespace, empty dirs included, before the
+ * first file.  Files are named by their age, the tick they were created
+ * at, so a create is usually 4 or 5 bytes and a delete not many more.
+ */
+class OpTrace {
+  public:
+    static const uint64_t MAGIC = 0x3163727469726567ULL; // "geritrc1"
+    enum kind_t { CREATE = 0, DELETE, DEFINE, DRAIN };
+    enum define_t { DIR = 0, SIZE };
+};
+
+/*
+ * TraceWriter records a trace.  Dirs are identified by a key of the
+ * caller's choosing and named by dir_name() the first time they are seen.
+ * Writes are buffered; errors stick in `failed' and are reported by
+ * close().  Only one thread may record.
+ */
+class TraceWriter {
+  public:
+    typedef std::function<std::string(uint64_t dir_key)> dir_name_fn;
+
+    static const size_t BUFSIZE = 1 << 20;
+    static const uint64_t NO_KEY = ~0ULL; // a dir no file goes in
+
+    TraceWriter() {
+      fp = NULL;
+      failed = false;
+      last_tick = 0;
+      ops = 0;
+      ndirs = 0;
+    }
+
+    ~TraceWriter() {
+      close();
+    }
+
+    int open(const char *path, dir_name_fn dir_name) {
+      fp = fopen(path, "w");
+      if(fp == NULL) {
+        return -1;
+      }
+      this->dir_name = dir_name;
+      buf.reserve(BUFSIZE);
+      uint64_t magic = OpTrace::MAGIC;
+      buf.insert(buf.end(), (uint8_t *) &magic, (uint8_t *) (&magic + 1));
+      return 0;
+    }
+
+    void create(uint64_t tick, uint64_t age, uint64_t dir_key, uint64_t len) {
+      auto dir = dirIndex(dir_key);
+      auto size = sizeIndex(len);
+      head(tick, OpTrace::CREATE);
+      varint(dir);
+      varint(size);
+      varint(tick - age);
+      ops++;
+    }
+
+    void remove(uint64_t tick, uint64_t age, uint64_t dir_key) {
+      auto dir = dirIndex(dir_key);
+      head(tick, OpTrace::DELETE);
+      varint(dir);
+      varint(tick - age);
+      ops++;
+    }
+
+    /*
+     * DEFINE a dir before any file uses it, e.g. a parent with no files
+     * of its own (key NO_KEY) or an empty sibling dir, so the replay makes
+     * it too
+     */
+    void defineDir(const std::string &name, uint64_t key = NO_KEY) {
+      if((key != NO_KEY) && (dirs.find(key) != dirs.end())) {
+        return;
+      }
+      auto index = define(name);
+      if(key != NO_KEY) {
+        dirs[key] = index;
+      }
+    }
+
+    void drain(uint64_t tick) {
+      head(tick, OpTrace::DRAIN);
+    }
+
+    uint64_t recorded() const {
+      return ops;
+    }
+
+    /* flush and close, 0 if the whole trace made it to the file */
+    int close() {
+      if(fp == NULL) {
+        return failed ? -1 : 0;
+      }
+      flush();
+      if(fclose(fp) != 0) {
+        failed = true;
+      }
+      fp = NULL;
+      return failed ? -1 : 0;
+    }
+
+  private:
+    FILE *fp;
+    bool failed;
+    std::vector<uint8_t> buf;
+    uint64_t last_tick;
+    uint64_t ops;
+    uint64_t ndirs; // dirs DEFINEd so far
+    dir_name_fn dir_name;
+    boost::unordered_map<uint64_t, uint64_t> dirs; // dir key -> index
+    boost::unordered_map<uint64_t, uint64_t> sizes; // bytes -> index
+    std::string last_dir; // the dir DEFINEd last
+
+    void flush() {
+      if(!failed && !buf.empty() &&
+          (fwrite(buf.data(), 1, buf.size(), fp) != buf.size())) {
+        failed = true;
+      }
+      buf.clear();
+    }
+
+    void varint(uint64_t v) {
+      while(v >= 0x80) {
+        buf.push_back((uint8_t) (v | 0x80));
+        v >>= 7;
+      }
+      buf.push_back((uint8_t) v);
+    }
+
+    void head(uint64_t tick, OpTrace::kind_t kind) {
+      if(buf.size() >= BUFSIZE - 64) {
+        flush();
+      }
+      varint(((tick - last_tick) << 2) | kind);
+      last_tick = tick;
+    }
+
+    uint64_t dirIndex(uint64_t key) {
+      auto it = dirs.find(key);
+      if(it != dirs.end()) {
+        return it->second;
+      }
+      auto index = define(dir_name(key));
+      dirs[key] = index;
+      return index;
+    }
+
+    /* DEFINE the next dir, its index */
+    uint64_t define(const std::string &name) {
+      size_t k = 0;
+      while((k < name.size()) && (k < last_dir.size()) &&
+          (name[k] == last_dir[k])) {
+        k++;
+      }
+      head(last_tick, OpTrace::DEFINE);
+      varint(OpTrace::DIR);
+      varint(k);
+      varint(name.size() - k);
+      buf.insert(buf.end(), name.begin() + k, name.end());
+      last_dir = name;
+      return ndirs++;
+    }
+
+    uint64_t sizeIndex(uint64_t len) {
+      auto it = sizes.find(len);
+      if(it != sizes.end()) {
+        return it->second;
+      }
+      head(last_tick, OpTrace::DEFINE);
+      varint(OpTrace::SIZE);
+      varint(len);
+      auto index = sizes.size();
+      sizes[len] = index;
+      return index;
+    }
+};
+
+/*
+ * TraceReader maps a trace and decodes it record by record, so replaying
+ * even a huge one costs no more memory than its dirs and sizes.  next()
+ * hands out creates, deletes, drains and the dirs as they are DEFINEd
+ * (the replay has to make them); it returns false at the end of the
+ * trace, with `truncated' set if the trace ends in the middle of a record
+ * (e.g. the recording run was killed) or has a record that makes no
+ * sense.
+ */
+class TraceReader {
+  public:
+    struct Op {
+      OpTrace::kind_t kind; // DEFINE for a new dir
+      uint64_t tick;
+      uint64_t age; // file name
+      uint64_t dir; // index of the file's dir, or of the new dir
+      uint64_t len; // bytes to allocate (CREATE only)
+    };
+
+    bool truncated;
+
+    TraceReader() {
+      base = pos = end = NULL;
+      size = 0;
+      tick = 0;
+      truncated = false;
+    }
+
+    ~TraceReader() {
+      if(base) {
+        munmap((void *) base, size);
+      }
+    }
+
+    /* 0, or -1 with errno set (EINVAL if it is not a trace) */
+    int open(const char *path) {
+      int fd = ::open(path, O_RDONLY);
+      if(fd < 0) {
+        return -1;
+      }
+      struct stat st;
+      if(fstat(fd, &st) < 0) {
+        ::close(fd);
+        return -1;
+      }
+      size = st.st_size;
+      uint64_t magic = 0;
+      if(size >= sizeof(magic)) {
+        void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m == MAP_FAILED) {
+          ::close(fd);
+          return -1;
+        }
+        base = (const uint8_t *) m;
+        madvise(m, size, MADV_SEQUENTIAL);
+        memcpy(&magic, base, sizeof(magic));
+      }
+      ::close(fd);
+      if(magic != OpTrace::MAGIC) {
+        errno = EINVAL;
+        return -1;
+      }
+      pos = base + sizeof(magic);
+      end = base + size;
+      return 0;
+    }
+
+    bool next(Op &op) {
+      while(pos < end) {
+        uint64_t h, what, v, n;
+        if(!varint(h)) {
+          return false;
+        }
+        tick += h >> 2;
+        op.kind = (OpTrace::kind_t) (h & 3);
+        op.tick = tick;
+        switch(op.kind) {
+          case OpTrace::CREATE:
+            if(!varint(op.dir) || !varint(v) || !varint(op.age)) {
+              return false;
+            }
+            if((op.dir >= dirs.size()) || (v >= sizes.size()) ||
+                (op.age > tick)) {
+              return corrupt();
+            }
+            op.len = sizes[v];
+            op.age = tick - op.age;
+            return true;
+          case OpTrace::DELETE:
+            if(!varint(op.dir) || !varint(op.age)) {
+              return false;
+            }
+            if((op.dir >= dirs.size()) || (op.age > tick)) {
+              return corrupt();
+            }
+            op.len = 0;
+            op.age = tick - op.age;
+            return true;
+          case OpTrace::DEFINE:
+            if(!varint(what) || !varint(v)) {
+              return false;
+            }
+            if(what == OpTrace::SIZE) {
+              sizes.push_back(v);
+              continue;
+            }
+            if((what != OpTrace::DIR) || !varint(n)) {
+              return false;
+            }
+            if((v > last_dir.size()) || (n > (uint64_t) (end - pos))) {
+              return corrupt();
+            }
+            last_dir.resize(v);
+            last_dir.append((const char *) pos, n);
+            pos += n;
+            op.dir = dirs.size();
+            dirs.push_back(last_dir);
+            return true;
+          case OpTrace::DRAIN:
+            return true;
+        }
+      }
+      return false;
+    }
+
+    /* relative path of a dir next() has returned */
+    const std::string& dir(uint64_t i) const {
+      return dirs[i];
+    }
+
+    /* how far into the trace, 0 to 1 */
+    double progress() const {
+      return size ? (double) (pos - base) / size : 1;
+    }
+
+  private:
+    const uint8_t *base, *pos, *end;
+    size_t size;
+    uint64_t tick;
+    std::vector<std::string> dirs;
+    std::vector<uint64_t> sizes;
+    std::string last_dir;
+
+    bool varint(uint64_t &v) {
+      v = 0;
+      for(int shift = 0; shift < 64; shift += 7) {
+        if(pos == end) {
+          truncated = true;
+          return false;
+        }
+        uint8_t b = *pos++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if(!(b & 0x80)) {
+          return true;
+        }
+      }
+      return corrupt();
+    }
+
+    bool corrupt() {
+      truncated = true;
+      pos = end;
+      return false;
+    }
+};
+#endif  /* OP_TRACE_ */
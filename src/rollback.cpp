@@ -0,0 +1,545 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * rollback: put a partition a benchmark ran on back to the aged image it
+ * was dd'ed from, by copying back only the blocks the benchmark wrote.
+ * Those are read from blkparse output (blkparse -a write ...) as the
+ * blktrace of the benchmark run is parsed, one line at a time, into a
+ * compressed bitmap of 4K blocks.  Adjacent blocks are then copied as
+ * one extent, big extents cut into chunks, by a pool of threads with
+ * copy_file_range() or, where the kernel can't (e.g. file to block
+ * device), pread()/pwrite().
+ *
+ * Without blktrace the blocks come from the change map of a
+ * geriatrix --track run (-m): its changed file data is copied as above,
+ * and everything that is neither changed nor the image's own file data
+ * (the file system's metadata, mostly) is compared with the image and
+ * rewritten where it differs.  -d compares the whole partition.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "block_bitmap.h"
+#include "change_map.h"
+
+#define BLOCK 4096
+#define SECTOR 512  /* blkparse sector size */
+#define THREADS 16  /* default copy threads (-t) */
+#define CHUNK_KB 8192  /* default max bytes per copy call (-c) */
+
+/* byte range to restore */
+struct Chunk {
+  uint64_t off;
+  uint64_t len;
+};
+
+/*
+ * add the 4K blocks written by every write in blkparse output to written.
+ * A line is "dev cpu seq time pid action rwbs sector + nsectors ...";
+ * only lines whose rwbs starts with W count, sector is on the disk so
+ * the partition's offset (in sectors) is taken off.
+ */
+static int parseBlkparse(FILE *fp, uint64_t offset, BlockBitmap &written,
+    uint64_t &nwrites, uint64_t &skipped) {
+  char *line = NULL;
+  size_t cap = 0;
+  nwrites = skipped = 0;
+  while(getline(&line, &cap, fp) >= 0) {
+    char *fields[10];
+    int n = 0;
+    for(char *p = line; *p && (n < 10); ) {
+      p += strspn(p, " \t\r\n");
+      if(*p == '\0') {
+        break;
+      }
+      fields[n++] = p;
+      p += strcspn(p, " \t\r\n");
+    }
+    if((n < 10) || (fields[6][0] != 'W') || (fields[8][0] != '+')) {
+      continue;
+    }
+    uint64_t sector = strtoull(fields[7], NULL, 10);
+    uint64_t nsect = strtoull(fields[9], NULL, 10);
+    nwrites++;
+    if((sector < offset) || (nsect == 0)) {
+      skipped++; // before the partition
+      continue;
+    }
+    sector -= offset;
+    uint64_t first = sector / (BLOCK / SECTOR);
+    uint64_t last = (sector + nsect + (BLOCK / SECTOR) - 1) /
+      (BLOCK / SECTOR);
+    written.addRange(first, last - first);
+  }
+  free(line);
+  return ferror(fp) ? -1 : 0;
+}
+
+/* cut byte ranges into chunks of at most chunk bytes */
+static std::vector<Chunk> cutChunks(const std::vector<Chunk> &ranges,
+    uint64_t chunk) {
+  std::vector<Chunk> chunks;
+  for(auto &r : ranges) {
+    for(uint64_t done = 0; done < r.len; done += chunk) {
+      chunks.push_back({r.off + done, std::min(chunk, r.len - done)});
+    }
+  }
+  return chunks;
+}
+
+/*
+ * cut the written blocks into chunks of at most chunk bytes, joining
+ * extents less than gap blocks apart, and dropping what lies past the
+ * end of the image
+ */
+static std::vector<Chunk> planChunks(const BlockBitmap &written,
+    uint64_t image_size, uint64_t chunk, uint64_t gap, uint64_t &extents,
+    uint64_t &beyond) {
+  std::vector<Chunk> extents_v;
+  written.forEachExtent([&](uint64_t start, uint64_t len) {
+    uint64_t off = start * BLOCK, end = (start + len) * BLOCK;
+    if(!extents_v.empty() &&
+        (off - (extents_v.back().off + extents_v.back().len) <=
+         gap * BLOCK)) {
+      extents_v.back().len = end - extents_v.back().off;
+    } else {
+      extents_v.push_back({off, end - off});
+    }
+  });
+  extents = extents_v.size();
+  beyond = 0;
+  for(auto &e : extents_v) {
+    if(e.off + e.len > image_size) {
+      uint64_t keep = (e.off < image_size) ? image_size - e.off : 0;
+      beyond += e.len - keep;
+      e.len = keep;
+    }
+  }
+  return cutChunks(extents_v, chunk);
+}
+
+/*
+ * the byte ranges of the image holding none of the known blocks, in
+ * chunks of at most chunk bytes
+ */
+static std::vector<Chunk> planCompare(const BlockBitmap &known,
+    uint64_t image_size, uint64_t chunk, uint64_t &ranges) {
+  std::vector<Chunk> gaps;
+  uint64_t at = 0;
+  known.forEachExtent([&](uint64_t start, uint64_t len) {
+    uint64_t off = std::min(start * BLOCK, image_size);
+    if(off > at) {
+      gaps.push_back({at, off - at});
+    }
+    at = std::max(at, std::min((start + len) * BLOCK, image_size));
+  });
+  if(at < image_size) {
+    gaps.push_back({at, image_size - at});
+  }
+  ranges = gaps.size();
+  return cutChunks(gaps, chunk);
+}
+
+/* copy one chunk with pread/pwrite, 0 or an errno */
+static int copyRw(int in, int out, const Chunk &c, std::vector<char> &buf) {
+  uint64_t done = 0;
+  while(done < c.len) {
+    auto n = pread(in, buf.data(), std::min((uint64_t) buf.size(),
+          c.len - done), c.off + done);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    if(n == 0) {
+      return EIO; // the image got shorter
+    }
+    for(ssize_t w = 0; w < n; ) {
+      auto m = pwrite(out, buf.data() + w, n - w, c.off + done + w);
+      if(m < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        return errno;
+      }
+      w += m;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+/* read up to len bytes at off, the bytes read or -1 (errno) */
+static ssize_t readFully(int fd, char *buf, size_t len, uint64_t off) {
+  size_t done = 0;
+  while(done < len) {
+    auto n = pread(fd, buf + done, len - done, off + done);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if(n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+/*
+ * compare one chunk of out with in and rewrite the 4K blocks of out that
+ * differ (or that out is too short to have), 0 or an errno
+ */
+static int diffRw(int in, int out, const Chunk &c, std::vector<char> &ibuf,
+    std::vector<char> &obuf, uint64_t &rewritten) {
+  for(uint64_t done = 0; done < c.len; ) {
+    size_t len = std::min((uint64_t) ibuf.size(), c.len - done);
+    uint64_t off = c.off + done;
+    auto n = readFully(in, ibuf.data(), len, off);
+    auto m = readFully(out, obuf.data(), len, off);
+    if((n < 0) || (m < 0)) {
+      return errno;
+    }
+    if((size_t) n < len) {
+      return EIO; // the image got shorter
+    }
+    size_t b = 0;
+    while(b < len) {
+      // the next run of differing blocks
+      size_t blen = std::min((size_t) BLOCK, len - b);
+      if((b + blen <= (size_t) m) &&
+          (memcmp(ibuf.data() + b, obuf.data() + b, blen) == 0)) {
+        b += blen;
+        continue;
+      }
+      size_t e = b + blen;
+      while(e < len) {
+        size_t elen = std::min((size_t) BLOCK, len - e);
+        if((e + elen <= (size_t) m) &&
+            (memcmp(ibuf.data() + e, obuf.data() + e, elen) == 0)) {
+          break;
+        }
+        e += elen;
+      }
+      for(size_t w = b; w < e; ) {
+        auto k = pwrite(out, ibuf.data() + w, e - w, off + w);
+        if(k < 0) {
+          if(errno == EINTR) {
+            continue;
+          }
+          return errno;
+        }
+        w += k;
+      }
+      rewritten += e - b;
+      b = e;
+    }
+    done += len;
+  }
+  return 0;
+}
+
+#ifdef HAVE_COPY_FILE_RANGE
+/*
+ * copy one chunk in the kernel.  0, an errno, or -1 if copy_file_range()
+ * can't copy between these two files at all.
+ */
+static int copyCfr(int in, int out, const Chunk &c) {
+  loff_t ioff = c.off, ooff = c.off;
+  uint64_t left = c.len;
+  while(left > 0) {
+    auto n = copy_file_range(in, &ioff, out, &ooff, left, 0);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      if((left == c.len) && ((errno == EINVAL) || (errno == EXDEV) ||
+            (errno == ENOSYS) || (errno == EOPNOTSUPP) ||
+            (errno == EBADF))) {
+        return -1;
+      }
+      return errno;
+    }
+    if(n == 0) {
+      return EIO;
+    }
+    left -= n;
+  }
+  return 0;
+}
+#endif
+
+/*
+ * copy every chunk from in to out on `threads' threads, each taking the
+ * next chunk in offset order.  Once copy_file_range() is found not to
+ * work everyone switches to pread/pwrite.  0 or an errno.
+ */
+static int copyChunks(int in, int out, const std::vector<Chunk> &chunks,
+    int threads, bool use_cfr, size_t bufsize, std::atomic<bool> &cfr_ok) {
+  std::atomic<size_t> next(0);
+  std::atomic<int> error(0);
+  cfr_ok = use_cfr;
+  std::vector<std::thread> pool;
+  for(int t=0; t<threads; t++) {
+    pool.emplace_back([&] {
+      std::vector<char> buf;
+      for(auto i = next++; (i < chunks.size()) && (error.load() == 0);
+          i = next++) {
+        int rv = -1;
+#ifdef HAVE_COPY_FILE_RANGE
+        if(cfr_ok.load()) {
+          rv = copyCfr(in, out, chunks[i]);
+          if(rv < 0) {
+            cfr_ok = false;
+          }
+        }
+#endif
+        if(rv < 0) {
+          if(buf.empty()) {
+            buf.resize(bufsize);
+          }
+          rv = copyRw(in, out, chunks[i], buf);
+        }
+        if(rv != 0) {
+          int none = 0;
+          error.compare_exchange_strong(none, rv);
+        }
+      }
+    });
+  }
+  for(auto &t : pool) {
+    t.join();
+  }
+  return error.load();
+}
+
+/*
+ * compare every chunk of out with in on `threads' threads and rewrite
+ * what differs, adding up the bytes rewritten.  0 or an errno.
+ */
+static int diffChunks(int in, int out, const std::vector<Chunk> &chunks,
+    int threads, size_t bufsize, std::atomic<uint64_t> &rewritten) {
+  std::atomic<size_t> next(0);
+  std::atomic<int> error(0);
+  std::vector<std::thread> pool;
+  for(int t=0; t<threads; t++) {
+    pool.emplace_back([&] {
+      std::vector<char> ibuf(bufsize), obuf(bufsize);
+      uint64_t mine = 0;
+      for(auto i = next++; (i < chunks.size()) && (error.load() == 0);
+          i = next++) {
+        int rv = diffRw(in, out, chunks[i], ibuf, obuf, mine);
+        if(rv != 0) {
+          int none = 0;
+          error.compare_exchange_strong(none, rv);
+        }
+      }
+      rewritten += mine;
+    });
+  }
+  for(auto &t : pool) {
+    t.join();
+  }
+  return error.load();
+}
+
+void usage() {
+  std::cout << "usage: rollback [-t <threads (default " << THREADS <<
+    ")>] [-c <max KB per copy (default " << CHUNK_KB << ")>]" << std::endl;
+  std::cout << "                [-g <join extents up to this many blocks " <<
+    "apart (default 0)>]" << std::endl;
+  std::cout << "                [-r (pread/pwrite only)] [-n (dry run)]" <<
+    std::endl;
+  std::cout << "                <blkparse output, - for stdin> " <<
+    "<partition offset in sectors>" << std::endl;
+  std::cout << "                <image> <partition>" << std::endl;
+  std::cout << "       rollback [options] -m <geriatrix --track map> " <<
+    "<image> <partition>" << std::endl;
+  std::cout << "       rollback [options] -d <image> <partition> " <<
+    "(compare everything)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  int threads = THREADS;
+  uint64_t chunk_kb = CHUNK_KB;
+  uint64_t gap = 0;
+  int rw_only = 0;
+  int dry_run = 0;
+  const char *map_file = NULL;
+  int diff_all = 0;
+  int option;
+  while((option = getopt(argc, argv, "t:c:g:rnm:d")) != EOF) {
+    switch(option) {
+      case 't': threads = atoi(optarg); break;
+      case 'c': chunk_kb = strtoull(optarg, NULL, 10); break;
+      case 'g': gap = strtoull(optarg, NULL, 10); break;
+      case 'r': rw_only = 1; break;
+      case 'n': dry_run = 1; break;
+      case 'm': map_file = optarg; break;
+      case 'd': diff_all = 1; break;
+      default: usage(); exit(1);
+    }
+  }
+  bool compare = map_file || diff_all;
+  if((argc - optind != (compare ? 2 : 4)) || (map_file && diff_all) ||
+      (threads < 1) || (chunk_kb < BLOCK / 1024)) {
+    usage();
+    exit(1);
+  }
+  const char *image = argv[argc - 2];
+  const char *partition = argv[argc - 1];
+  uint64_t chunk = chunk_kb / (BLOCK / 1024) * BLOCK;
+
+  // the blocks to copy (changed) and those not to compare (base)
+  auto t0 = std::chrono::steady_clock::now();
+  ChangeMap map;
+  if(map_file) {
+    if(map.load(map_file) < 0) {
+      fprintf(stderr, "error: cannot read change map %s: %s\n", map_file,
+          strerror(errno));
+      exit(1);
+    }
+    std::cout << "Loaded " << map.changed.count() << " blocks changed, " <<
+      map.base.count() << " blocks of base files" << std::endl;
+    map.base.merge(map.changed);
+  } else if(!diff_all) {
+    const char *trace = argv[optind];
+    uint64_t offset = strtoull(argv[optind + 1], NULL, 10);
+    FILE *fp = (strcmp(trace, "-") == 0) ? stdin : fopen(trace, "r");
+    if(fp == NULL) {
+      fprintf(stderr, "error: cannot read %s: %s\n", trace, strerror(errno));
+      exit(1);
+    }
+    uint64_t nwrites, skipped;
+    if(parseBlkparse(fp, offset, map.changed, nwrites, skipped) < 0) {
+      fprintf(stderr, "error: reading %s: %s\n", trace, strerror(errno));
+      exit(1);
+    }
+    if(fp != stdin) {
+      fclose(fp);
+    }
+    std::cout << "Parsed " << nwrites << " writes, " << map.changed.count() <<
+      " blocks written (bitmap " << map.changed.bytes() / 1024 << " KB) in " <<
+      std::chrono::duration<double>(std::chrono::steady_clock::now() -
+          t0).count() << " secs" << std::endl;
+    if(skipped > 0) {
+      std::cout << "Skipped " << skipped << " writes before the partition" <<
+        std::endl;
+    }
+  }
+  auto t1 = std::chrono::steady_clock::now();
+
+  // plan
+  int in = open(image, O_RDONLY);
+  if(in < 0) {
+    fprintf(stderr, "error: cannot open %s: %s\n", image, strerror(errno));
+    exit(1);
+  }
+  off_t image_size = lseek(in, 0, SEEK_END);
+  if(image_size < 0) {
+    fprintf(stderr, "error: cannot size %s: %s\n", image, strerror(errno));
+    exit(1);
+  }
+  uint64_t extents, beyond;
+  auto chunks = planChunks(map.changed, image_size, chunk, gap, extents,
+      beyond);
+  uint64_t bytes = 0;
+  for(auto &c : chunks) {
+    bytes += c.len;
+  }
+  if(beyond > 0) {
+    std::cout << "Skipped " << beyond / BLOCK << " blocks past the end " <<
+      "of the image" << std::endl;
+  }
+  if(!diff_all) {
+    std::cout << "Restoring " << bytes / 1048576 << " MB in " << extents <<
+      " extents (" << chunks.size() << " copies)" << std::endl;
+  }
+  uint64_t ranges = 0, cmp_bytes = 0;
+  std::vector<Chunk> cmp_chunks;
+  if(compare) {
+    cmp_chunks = planCompare(map.base, image_size, chunk, ranges);
+    for(auto &c : cmp_chunks) {
+      cmp_bytes += c.len;
+    }
+    std::cout << "Comparing " << cmp_bytes / 1048576 << " MB in " << ranges <<
+      " ranges (" << cmp_chunks.size() << " reads)" << std::endl;
+  }
+  if(dry_run) {
+    close(in);
+    return 0;
+  }
+
+  // copy
+  int out = open(partition, compare ? O_RDWR : O_WRONLY);
+  if(out < 0) {
+    fprintf(stderr, "error: cannot open %s: %s\n", partition,
+        strerror(errno));
+    exit(1);
+  }
+  size_t bufsize = std::min(chunk, (uint64_t) 1 << 20);
+  std::atomic<bool> cfr_ok(false);
+  int rv = copyChunks(in, out, chunks, threads, !rw_only, bufsize, cfr_ok);
+  if(rv != 0) {
+    fprintf(stderr, "error: copying %s to %s: %s\n", image, partition,
+        strerror(rv));
+    exit(1);
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  // compare
+  std::atomic<uint64_t> rewritten(0);
+  if(compare) {
+    rv = diffChunks(in, out, cmp_chunks, threads, bufsize, rewritten);
+    if(rv != 0) {
+      fprintf(stderr, "error: comparing %s with %s: %s\n", partition, image,
+          strerror(rv));
+      exit(1);
+    }
+  }
+  if(fdatasync(out) < 0) {
+    fprintf(stderr, "error: syncing %s: %s\n", partition, strerror(errno));
+    exit(1);
+  }
+  close(out);
+  close(in);
+  auto t3 = std::chrono::steady_clock::now();
+  if(!diff_all) {
+    double secs = std::chrono::duration<double>(t2 - t1).count();
+    std::cout << "Restored " << bytes / 1048576 << " MB in " << secs <<
+      " secs, " << bytes / 1048576.0 / std::max(secs, 1e-9) << " MB/sec (" <<
+      threads << " threads, " << (cfr_ok.load() ? "copy_file_range" :
+          "pread/pwrite") << ")" << std::endl;
+  }
+  if(compare) {
+    double secs = std::chrono::duration<double>(t3 - t2).count();
+    std::cout << "Compared " << cmp_bytes / 1048576 << " MB and rewrote " <<
+      rewritten.load() / 1048576 << " MB (" << rewritten.load() / BLOCK <<
+      " blocks) in " << secs << " secs, " << cmp_bytes / 1048576.0 /
+      std::max(secs, 1e-9) << " MB/sec" << std::endl;
+  }
+  return 0;
+}
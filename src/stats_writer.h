@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#ifndef STATS_WRITER_
+#define STATS_WRITER_
+/*
+ * StatsWriter writes the distribution and fragmentation dumps on a thread
+ * of its own, so the planner never waits on file I/O.  The planner copies
+ * what it wants dumped and submits a function printing that copy; the
+ * writer runs it into <path>.tmp and renames it over path, so whoever
+ * watches the file only ever sees a whole dump.  A dump still waiting is
+ * replaced by a newer one of the same path.  Before start() and after
+ * stop() submit() writes the file right away.  Only the planner thread
+ * may call it.
+ */
+class StatsWriter {
+  public:
+    typedef std::function<void(FILE *fp)> dump_fn;
+
+    StatsWriter() {
+      running = false;
+      stopping = false;
+    }
+
+    ~StatsWriter() {
+      stop();
+    }
+
+    void start() {
+      if(running) {
+        return;
+      }
+      stopping = false;
+      running = true;
+      writer = std::thread([this] { run(); });
+    }
+
+    void submit(const std::string &path, dump_fn dump) {
+      if(!running) {
+        write(path, dump);
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending[path] = dump;
+      }
+      cond.notify_one();
+    }
+
+    /* write the dumps still waiting and stop the thread */
+    void stop() {
+      if(!running) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      cond.notify_one();
+      writer.join();
+      running = false;
+    }
+
+  private:
+    bool running; // writer thread started
+    bool stopping;
+    std::map<std::string, dump_fn> pending; // by path
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread writer;
+
+    void run() {
+      std::unique_lock<std::mutex> lock(mutex);
+      while(1) {
+        cond.wait(lock, [this] { return stopping || !pending.empty(); });
+        if(pending.empty()) {
+          return;
+        }
+        std::map<std::string, dump_fn> batch;
+        batch.swap(pending);
+        lock.unlock();
+        for(auto &p : batch) {
+          write(p.first, p.second);
+        }
+        lock.lock();
+      }
+    }
+
+    static void write(const std::string &path, const dump_fn &dump) {
+      auto tmp = path + ".tmp";
+      FILE *fp = fopen(tmp.c_str(), "w");
+      if(fp == NULL) {
+        fprintf(stderr, "warning: cannot write %s: %s\n", tmp.c_str(),
+            strerror(errno));
+        return;
+      }
+      dump(fp);
+      bool failed = ferror(fp);
+      failed |= (fclose(fp) != 0);
+      if(failed || (rename(tmp.c_str(), path.c_str()) < 0)) {
+        fprintf(stderr, "warning: writing %s failed: %s\n", path.c_str(),
+            strerror(errno));
+        unlink(tmp.c_str());
+      }
+    }
+};
+#endif  /* STATS_WRITER_ */
@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2018 Carnegie Mellon University.
+ *
+ * All rights reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * io_uring based I/O path for posix filesystems.  instead of one
+ * blocking syscall per step on an IoExecutor worker, each create is
+ * submitted as a linked openat -> fallocate -> close chain (the file
+ * lives in a fixed file slot between the steps, so nothing has to come
+ * back to user space) and each delete as a single unlinkat.  many such
+ * chains are kept in flight and submitted in batches.
+ *
+ * we talk to the kernel directly through the raw syscalls so the only
+ * build requirement is a <linux/io_uring.h> new enough to have
+ * IORING_OP_UNLINKAT (linux 5.11+).  openat into a fixed file slot
+ * needs linux 5.15+ at runtime; init() fails cleanly if the kernel does
+ * not support it and the caller falls back to the IoExecutor workers.
+ */
+
+#ifndef URING_EXECUTOR_
+#define URING_EXECUTOR_
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+#include "io_executor.h"
+#include "op_stats.h"
+
+class UringExecutor {
+  public:
+    bool replaying; // unlinks may find the file already gone (--resume)
+    OpStats *op_stats; // completed ops are counted here if set
+
+    UringExecutor(unsigned depth) {
+      this->depth = depth;
+      replaying = false;
+      op_stats = NULL;
+      ring_fd = -1;
+      sq_ptr = cq_ptr = NULL;
+      sqes = NULL;
+      sq_map_size = cq_map_size = 0;
+      to_submit = 0;
+      busy = 0;
+    }
+
+    ~UringExecutor() {
+      if(ring_fd >= 0) {
+        drain();
+      }
+      if(sqes != NULL) {
+        munmap(sqes, sq_entries * sizeof(struct io_uring_sqe));
+      }
+      if((cq_ptr != NULL) && (cq_ptr != sq_ptr)) {
+        munmap(cq_ptr, cq_map_size);
+      }
+      if(sq_ptr != NULL) {
+        munmap(sq_ptr, sq_map_size);
+      }
+      if(ring_fd >= 0) {
+        close(ring_fd);
+      }
+    }
+
+    /*
+     * set up the ring and the fixed file table.  returns 0 on success,
+     * otherwise -1 with errno set and the executor must not be used.
+     */
+    int init() {
+      struct io_uring_params p;
+      memset(&p, 0, sizeof(p));
+      /* up to 3 sqes per create chain */
+      ring_fd = syscall(__NR_io_uring_setup, depth * 4, &p);
+      if(ring_fd < 0) {
+        return -1;
+      }
+      sq_entries = p.sq_entries;
+
+      sq_map_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+      cq_map_size = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+      if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(cq_map_size > sq_map_size) {
+          sq_map_size = cq_map_size;
+        }
+        cq_map_size = sq_map_size;
+      }
+      sq_ptr = (char *) mmap(NULL, sq_map_size, PROT_READ|PROT_WRITE,
+          MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+      if(sq_ptr == MAP_FAILED) {
+        sq_ptr = NULL;
+        return -1;
+      }
+      if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ptr = sq_ptr;
+      } else {
+        cq_ptr = (char *) mmap(NULL, cq_map_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if(cq_ptr == MAP_FAILED) {
+          cq_ptr = NULL;
+          return -1;
+        }
+      }
+      sqes = (struct io_uring_sqe *) mmap(NULL,
+          p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE,
+          MAP_SHARED|MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+      if(sqes == MAP_FAILED) {
+        sqes = NULL;
+        return -1;
+      }
+
+      sq_head = (unsigned *) (sq_ptr + p.sq_off.head);
+      sq_tail = (unsigned *) (sq_ptr + p.sq_off.tail);
+      sq_mask = *(unsigned *) (sq_ptr + p.sq_off.ring_mask);
+      sq_array = (unsigned *) (sq_ptr + p.sq_off.array);
+      cq_head = (unsigned *) (cq_ptr + p.cq_off.head);
+      cq_tail = (unsigned *) (cq_ptr + p.cq_off.tail);
+      cq_mask = *(unsigned *) (cq_ptr + p.cq_off.ring_mask);
+      cqes = (struct io_uring_cqe *) (cq_ptr + p.cq_off.cqes);
+
+      /* one fixed file slot per in-flight create */
+      std::vector<int> fds(depth, -1);
+      if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES,
+            fds.data(), depth) < 0) {
+        return -1;
+      }
+
+      slots.resize(depth);
+      for(unsigned i=0; i<depth; i++) {
+        free_slots.push_back(depth - 1 - i);
+      }
+
+      /* make sure openat into a fixed slot works before relying on it */
+      int rv = probe();
+      stats = IoWindowStats();
+      return rv;
+    }
+
+    /* create path and allocate len bytes to it */
+    void create(const char *path, size_t len) {
+      auto s = getSlot();
+      auto &slot = slots[s];
+      slot.path = path;
+      slot.len = len;
+      slot.unlink_after = false;
+      slot.alloc_failed = false;
+      creating[slot.path] = s;
+      queueCreate(s);
+    }
+
+    /* unlink path, after its create if that is still in flight */
+    void unlink(const char *path) {
+      auto it = creating.find(path);
+      if(it != creating.end()) {
+        slots[it->second].unlink_after = true;
+        return;
+      }
+      auto s = getSlot();
+      slots[s].path = path;
+      queueUnlink(s);
+    }
+
+    /* wait until every queued operation has completed */
+    void drain() {
+      while(busy > 0) {
+        submit(1);
+        reap();
+      }
+    }
+
+    /* operations queued or in flight */
+    unsigned inflight() const {
+      return busy.load(std::memory_order_relaxed);
+    }
+
+    unsigned windowSize() const {
+      return depth;
+    }
+
+    const IoWindowStats& windowStats() const {
+      return stats;
+    }
+
+  private:
+    enum op_t { OP_OPEN = 1, OP_FALLOCATE, OP_CLOSE, OP_UNLINK };
+
+    struct Slot {
+      std::string path;
+      size_t len;
+      bool unlink_after; // unlink was requested while create in flight
+      bool alloc_failed; // fallocate failed, chain must be retried
+    };
+
+    unsigned depth;
+    int ring_fd;
+    char *sq_ptr, *cq_ptr;
+    size_t sq_map_size, cq_map_size;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit; // sqes queued but not yet submitted
+    std::atomic<unsigned> busy; // slots in use, read by ThroughputLog
+    IoWindowStats stats;
+
+    std::vector<Slot> slots;
+    std::vector<unsigned> free_slots;
+    boost::unordered_map<std::string, unsigned> creating;
+
+    int probe() {
+      auto s = getSlot();
+      auto sqe = getSqe();
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uint64_t) (uintptr_t) "/";
+      sqe->open_flags = O_RDONLY|O_DIRECTORY;
+      sqe->file_index = s + 1;
+      sqe->user_data = userData(s, OP_OPEN);
+      submit(1);
+      auto cqe = waitCqe();
+      int res = cqe->res;
+      cqeSeen();
+      if(res < 0) {
+        errno = -res;
+        return -1;
+      }
+      sqe = getSqe();
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->file_index = s + 1;
+      sqe->user_data = userData(s, OP_CLOSE);
+      submit(1);
+      cqe = waitCqe();
+      res = cqe->res;
+      cqeSeen();
+      putSlot(s);
+      if(res < 0) {
+        errno = -res;
+        return -1;
+      }
+      return 0;
+    }
+
+    static uint64_t userData(unsigned s, op_t op) {
+      return ((uint64_t) s << 8) | op;
+    }
+
+    unsigned getSlot() {
+      stats.record(busy);
+      if(free_slots.empty()) {
+        auto t0 = std::chrono::steady_clock::now();
+        while(free_slots.empty()) {
+          submit(1);
+          reap();
+        }
+        stats.stalls++;
+        stats.stall_ns +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - t0).count();
+      }
+      auto s = free_slots.back();
+      free_slots.pop_back();
+      busy++;
+      return s;
+    }
+
+    void putSlot(unsigned s) {
+      free_slots.push_back(s);
+      busy--;
+    }
+
+    /*
+     * make room for n sqes.  a link chain must not be split across two
+     * io_uring_enter calls, so callers reserve a whole chain up front.
+     */
+    void reserve(unsigned n) {
+      auto head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+      if(*sq_tail + to_submit - head + n > sq_entries) {
+        submit(1);
+        reap();
+      }
+    }
+
+    struct io_uring_sqe *getSqe() {
+      auto head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+      auto tail = *sq_tail + to_submit;
+      assert(tail - head < sq_entries);
+      (void) head;
+      auto idx = tail & sq_mask;
+      auto sqe = &sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sq_array[idx] = idx;
+      to_submit++;
+      return sqe;
+    }
+
+    void queueCreate(unsigned s) {
+      auto &slot = slots[s];
+      reserve(3);
+      auto sqe = getSqe();
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uint64_t) (uintptr_t) slot.path.c_str();
+      sqe->open_flags = O_RDWR|O_CREAT;
+      sqe->len = 0600;
+      sqe->file_index = s + 1;
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->user_data = userData(s, OP_OPEN);
+      queueAllocate(s, true);
+    }
+
+    /* fallocate (if needed) and close the file sitting in fixed slot s */
+    void queueAllocate(unsigned s, bool reserved = false) {
+      auto &slot = slots[s];
+      if(!reserved) {
+        reserve(2);
+      }
+      if(slot.len > 0) {
+        auto sqe = getSqe();
+        sqe->opcode = IORING_OP_FALLOCATE;
+        sqe->fd = s;
+        sqe->flags = IOSQE_FIXED_FILE|IOSQE_IO_LINK;
+        sqe->off = 0;
+        sqe->addr = slot.len;
+        sqe->len = 0;
+        sqe->user_data = userData(s, OP_FALLOCATE);
+      }
+      auto sqe = getSqe();
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->file_index = s + 1;
+      sqe->user_data = userData(s, OP_CLOSE);
+      submit(0);
+    }
+
+    void queueUnlink(unsigned s) {
+      reserve(1);
+      auto sqe = getSqe();
+      sqe->opcode = IORING_OP_UNLINKAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uint64_t) (uintptr_t) slots[s].path.c_str();
+      sqe->user_data = userData(s, OP_UNLINK);
+      submit(0);
+    }
+
+    /*
+     * publish queued sqes.  batches of less than a quarter of the ring
+     * are held back unless the caller needs to wait for completions.
+     */
+    void submit(unsigned wait) {
+      if((to_submit < sq_entries / 4) && (wait == 0)) {
+        return;
+      }
+      __atomic_store_n(sq_tail, *sq_tail + to_submit, __ATOMIC_RELEASE);
+      auto n = to_submit;
+      to_submit = 0;
+      unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+      if((n == 0) && (wait == 0)) {
+        return;
+      }
+      if(wait && cqReady()) {
+        wait = 0;
+        flags = 0;
+        if(n == 0) {
+          return;
+        }
+      }
+      int rv;
+      do {
+        rv = syscall(__NR_io_uring_enter, ring_fd, n, wait, flags, NULL, 0);
+      } while((rv < 0) && (errno == EINTR));
+      if(rv < 0) {
+        fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+        abort();
+      }
+    }
+
+    bool cqReady() {
+      return *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    struct io_uring_cqe *waitCqe() {
+      while(!cqReady()) {
+        int rv = syscall(__NR_io_uring_enter, ring_fd, 0, 1,
+            IORING_ENTER_GETEVENTS, NULL, 0);
+        if((rv < 0) && (errno != EINTR)) {
+          fprintf(stderr, "io_uring_enter: %s\n", strerror(errno));
+          abort();
+        }
+      }
+      return &cqes[*cq_head & cq_mask];
+    }
+
+    void cqeSeen() {
+      __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+    }
+
+    /* handle every completion that is ready */
+    void reap() {
+      while(cqReady()) {
+        auto cqe = &cqes[*cq_head & cq_mask];
+        unsigned s = cqe->user_data >> 8;
+        auto op = (op_t) (cqe->user_data & 0xff);
+        int res = cqe->res;
+        cqeSeen();
+        complete(s, op, res);
+      }
+    }
+
+    /*
+     * same error semantics as issueCreate()/issueDelete(): a failed
+     * fallocate is retried until it succeeds, any other failure is fatal.
+     */
+    void complete(unsigned s, op_t op, int res) {
+      auto &slot = slots[s];
+      switch(op) {
+        case OP_OPEN:
+          if(res < 0) {
+            fatal("open", slot.path, res);
+          }
+          break;
+
+        case OP_FALLOCATE:
+          if(res < 0) {
+            slot.alloc_failed = true;
+          }
+          break;
+
+        case OP_CLOSE:
+          if(slot.alloc_failed && (res == -ECANCELED)) {
+            /* the file is still open in its slot, try again */
+            slot.alloc_failed = false;
+            sleep(1);
+            queueAllocate(s);
+            break;
+          }
+          if(res < 0) {
+            fatal("close", slot.path, res);
+          }
+          creating.erase(slot.path);
+          if(op_stats) {
+            op_stats->opDone(slot.len);
+          }
+          if(slot.unlink_after) {
+            slot.unlink_after = false;
+            queueUnlink(s);
+          } else {
+            putSlot(s);
+          }
+          break;
+
+        case OP_UNLINK:
+          if((res == -ENOENT) && replaying) {
+            res = 0;
+          }
+          if(res < 0) {
+            fatal("unlink", slot.path, res);
+          }
+          if(op_stats) {
+            op_stats->opDone(0);
+          }
+          putSlot(s);
+          break;
+      }
+    }
+
+    void fatal(const char *what, const std::string &path, int res) {
+      fprintf(stderr, "io_uring: %s(%s): %s\n", what, path.c_str(),
+          strerror(-res));
+      abort();
+    }
+};
+
+#endif /* URING_EXECUTOR_ */